@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#include "allocator.h"
+
+namespace {
+	const int numBuckets = 32;
+	const int minimumBucket = 4;
+
+	struct CacheState {
+		std::mutex mutex;
+		std::vector<float*> buckets[numBuckets];
+		long long hits = 0;
+		long long misses = 0;
+	};
+
+	const size_t defaultChunkSize = 1 << 20;
+
+	struct ArenaPool {
+		std::mutex mutex;
+		std::vector<Arena*> arenas;
+	};
+
+	ArenaPool& getArenaPool() {
+		static ArenaPool* pool = new ArenaPool();
+		return *pool;
+	}
+
+	thread_local std::vector<Arena*> scopeStack;
+
+	// Never destroyed, so tensors released during static destruction can still return their buffers
+	CacheState& getState() {
+		static CacheState* state = new CacheState();
+		return *state;
+	}
+}
+
+void* alignedAllocate(size_t bytes)
+{
+#ifdef _MSC_VER
+	void* pointer = _aligned_malloc(bytes, tensorAlignment);
+	if (pointer == nullptr) throw std::bad_alloc();
+#else
+	void* pointer = nullptr;
+	if (posix_memalign(&pointer, tensorAlignment, bytes) != 0) throw std::bad_alloc();
+#endif
+	return pointer;
+}
+
+void alignedFree(void* pointer)
+{
+#ifdef _MSC_VER
+	_aligned_free(pointer);
+#else
+	free(pointer);
+#endif
+}
+
+int CachingAllocator::getBucket(int size)
+{
+	int bucket = minimumBucket;
+	while (bucket < numBuckets && (1LL << bucket) < size) bucket++;
+	return bucket;
+}
+
+float* CachingAllocator::allocate(int size)
+{
+	int bucket = getBucket(size);
+	//Buffers larger than every bucket are not cached
+	if (bucket == numBuckets) return static_cast<float*>(alignedAllocate(sizeof(float) * (size_t)size));
+	CacheState& state = getState();
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		std::vector<float*>& cached = state.buckets[bucket];
+		if (!cached.empty()) {
+			float* values = cached.back();
+			cached.pop_back();
+			state.hits++;
+			return values;
+		}
+		state.misses++;
+	}
+	return static_cast<float*>(alignedAllocate(sizeof(float) << bucket));
+}
+
+void CachingAllocator::deallocate(float* values, int size)
+{
+	int bucket = getBucket(size);
+	if (bucket == numBuckets) {
+		alignedFree(values);
+		return;
+	}
+	CacheState& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.buckets[bucket].push_back(values);
+}
+
+void CachingAllocator::emptyCache()
+{
+	CacheState& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	for (std::vector<float*>& cached : state.buckets) {
+		for (float* values : cached) alignedFree(values);
+		cached.clear();
+	}
+}
+
+long long CachingAllocator::getHits()
+{
+	CacheState& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.hits;
+}
+
+long long CachingAllocator::getMisses()
+{
+	CacheState& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.misses;
+}
+
+void CachingAllocator::resetStats()
+{
+	CacheState& state = getState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	state.hits = 0;
+	state.misses = 0;
+}
+
+Arena::Arena() : chunkIndex(0), chunkOffset(0), references(0)
+{
+}
+
+Arena::~Arena()
+{
+	for (Chunk& chunk : chunks) ::operator delete(chunk.memory);
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment)
+{
+	references++;
+	while (true) {
+		if (chunkIndex < chunks.size()) {
+			Chunk& chunk = chunks[chunkIndex];
+			uintptr_t address = (uintptr_t)(chunk.memory + chunkOffset);
+			size_t padding = (alignment - address % alignment) % alignment;
+			if (chunkOffset + padding + bytes <= chunk.size) {
+				void* pointer = chunk.memory + chunkOffset + padding;
+				chunkOffset += padding + bytes;
+				return pointer;
+			}
+			chunkIndex++;
+			chunkOffset = 0;
+			continue;
+		}
+		size_t chunkSize = std::max(defaultChunkSize, bytes + alignment);
+		chunks.push_back(Chunk{ static_cast<char*>(::operator new(chunkSize)), chunkSize });
+	}
+}
+
+void Arena::retain()
+{
+	references++;
+}
+
+void Arena::release()
+{
+	if (--references == 0) recycle();
+}
+
+size_t Arena::getCapacity() const
+{
+	size_t capacity = 0;
+	for (const Chunk& chunk : chunks) capacity += chunk.size;
+	return capacity;
+}
+
+void Arena::reset()
+{
+	//Merge the chunks used in this round so the next round fits into a single one
+	if (chunks.size() > 1) {
+		size_t capacity = getCapacity();
+		for (Chunk& chunk : chunks) ::operator delete(chunk.memory);
+		chunks.clear();
+		chunks.push_back(Chunk{ static_cast<char*>(::operator new(capacity)), capacity });
+	}
+	chunkIndex = 0;
+	chunkOffset = 0;
+}
+
+void Arena::recycle()
+{
+	reset();
+	ArenaPool& pool = getArenaPool();
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	pool.arenas.push_back(this);
+}
+
+ArenaScope::ArenaScope()
+{
+	ArenaPool& pool = getArenaPool();
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if (pool.arenas.empty()) {
+			arena = new Arena();
+		}
+		else {
+			arena = pool.arenas.back();
+			pool.arenas.pop_back();
+		}
+	}
+	arena->retain();
+	scopeStack.push_back(arena);
+}
+
+ArenaScope::~ArenaScope()
+{
+	scopeStack.pop_back();
+	arena->release();
+}
+
+Arena* ArenaScope::getCurrent()
+{
+	return scopeStack.empty() ? nullptr : scopeStack.back();
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Byte alignment of every tensor buffer, which covers a cache line and an AVX-512 register
+const int tensorAlignment = 64;
+
+// Allocates and frees memory aligned to tensorAlignment
+void* alignedAllocate(size_t bytes);
+void alignedFree(void* pointer);
+
+// Caches freed tensor buffers in power-of-two size classes so that buffers of the same size can be reused
+// across training iterations instead of going back to the system allocator every time.
+class CachingAllocator {
+private:
+	// Index of the smallest size class which holds size floats, or the number of classes if none is large enough
+	static int getBucket(int size);
+public:
+	static float* allocate(int size);
+	static void deallocate(float* values, int size);
+
+	// Releases every cached buffer back to the system
+	static void emptyCache();
+
+	static long long getHits();
+	static long long getMisses();
+	static void resetStats();
+};
+
+// Bump allocator behind an ArenaScope. Allocations are never freed individually; the arena counts the ones
+// still alive and rewinds to its first chunk once its scope has closed and the count reaches zero.
+class Arena {
+private:
+	struct Chunk {
+		char* memory;
+		size_t size;
+	};
+	std::vector<Chunk> chunks;
+	size_t chunkIndex;
+	size_t chunkOffset;
+	std::atomic<int> references;
+
+	void reset();
+	void recycle();
+public:
+	Arena();
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// Every allocation holds a reference which is dropped again by release
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	void retain();
+	void release();
+	size_t getCapacity() const;
+};
+
+// While an ArenaScope is alive every tensor buffer and gradient function created on this thread is bump
+// allocated from its arena, and all of them are released together with one reset when the scope exits.
+// Tensors which need to outlive the scope, such as updated parameters, must be moved out with Tensor::promote.
+// Anything left inside the arena when the scope exits delays the reset until it has been destroyed.
+class ArenaScope {
+private:
+	Arena* arena;
+public:
+	ArenaScope();
+	~ArenaScope();
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+
+	static Arena* getCurrent();
+};
+
+// Standard allocator which places objects in the arena that was active when the allocator was created,
+// or on the heap if there was none.
+template<typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	Arena* arena;
+
+	ArenaAllocator() : arena(ArenaScope::getCurrent()) {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count) {
+		if (arena) return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* pointer, size_t) {
+		if (arena) arena->release();
+		else ::operator delete(pointer);
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
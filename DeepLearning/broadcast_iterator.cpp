@@ -0,0 +1,66 @@
+#include <algorithm>
+
+#include "broadcast_iterator.h"
+#include "deep_learning.h"
+
+namespace {
+	std::vector<std::vector<int>> getShapes(const std::vector<const Tensor*>& operands)
+	{
+		std::vector<std::vector<int>> shapes;
+		for (const Tensor* operand : operands) shapes.push_back(operand->getShape());
+		return shapes;
+	}
+
+	std::vector<std::vector<int>> getStrides(const std::vector<const Tensor*>& operands)
+	{
+		std::vector<std::vector<int>> strides;
+		for (const Tensor* operand : operands) strides.push_back(operand->getStrides());
+		return strides;
+	}
+}
+
+BroadcastIterator::BroadcastIterator(const std::vector<int>& shape, const std::vector<const Tensor*>& operands) :
+	BroadcastIterator(shape, getShapes(operands), getStrides(operands))
+{
+}
+
+BroadcastIterator::BroadcastIterator(const std::vector<int>& shape, const std::vector<std::vector<int>>& operandShapes,
+	const std::vector<std::vector<int>>& operandStrides) : numOperands(operandShapes.size())
+{
+	for (int dim = 0; dim < shape.size(); dim++) {
+		if (shape[dim] == 1) continue;
+
+		//Operand dimensions are aligned from the end, and missing or size 1 dimensions are broadcast
+		std::vector<int> dimStrides(numOperands, 0);
+		for (int i = 0; i < numOperands; i++) {
+			int operandDim = dim - (int)(shape.size() - operandShapes[i].size());
+			if (operandDim >= 0 && operandShapes[i][operandDim] != 1) dimStrides[i] = operandStrides[i][operandDim];
+		}
+
+		//Dimensions which every operand steps through evenly are merged into the previous one
+		bool mergeable = !this->shape.empty();
+		for (int i = 0; i < numOperands && mergeable; i++) {
+			mergeable = strides[strides.size() - numOperands + i] == dimStrides[i] * shape[dim];
+		}
+		if (mergeable) {
+			this->shape.back() *= shape[dim];
+			std::copy(dimStrides.begin(), dimStrides.end(), strides.end() - numOperands);
+		}
+		else {
+			this->shape.push_back(shape[dim]);
+			strides.insert(strides.end(), dimStrides.begin(), dimStrides.end());
+		}
+	}
+	counter.assign(this->shape.size(), 0);
+	offsets.assign(numOperands, 0);
+}
+
+void BroadcastIterator::seek(int index)
+{
+	offsets.assign(numOperands, 0);
+	for (int dim = shape.size() - 1; dim >= 0; dim--) {
+		counter[dim] = index % shape[dim];
+		index /= shape[dim];
+		for (int i = 0; i < numOperands; i++) offsets[i] += counter[dim] * strides[dim * numOperands + i];
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+
+class Tensor;
+
+// Walks the elements of a shape in row-major order, keeping the offset of the current element in each operand.
+// Operands are broadcast to the shape by giving the dimensions they are broadcast along a stride of zero, and
+// offsets are updated incrementally so no per-element indices are built.
+class BroadcastIterator {
+private:
+	std::vector<int> shape;
+	std::vector<int> counter;
+	// Stride of every operand in each dimension, stored dimension by dimension
+	std::vector<int> strides;
+	std::vector<int> offsets;
+	int numOperands;
+public:
+	BroadcastIterator(const std::vector<int>& shape, const std::vector<const Tensor*>& operands);
+	BroadcastIterator(const std::vector<int>& shape, const std::vector<std::vector<int>>& operandShapes,
+		const std::vector<std::vector<int>>& operandStrides);
+
+	// Moves to the element at a row-major index of the shape, so that chunks of the shape can be walked separately
+	void seek(int index);
+
+	// Defined here so that kernels can inline the per-element step
+	int getOffset(int operand) const {
+		return offsets[operand];
+	}
+
+	void next() {
+		for (int dim = shape.size() - 1; dim >= 0; dim--) {
+			const int* dimStrides = &strides[dim * numOperands];
+			for (int i = 0; i < numOperands; i++) offsets[i] += dimStrides[i];
+			if (++counter[dim] < shape[dim]) return;
+			for (int i = 0; i < numOperands; i++) offsets[i] -= dimStrides[i] * shape[dim];
+			counter[dim] = 0;
+		}
+	}
+};
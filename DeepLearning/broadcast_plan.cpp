@@ -0,0 +1,120 @@
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "broadcast_plan.h"
+#include "deep_learning.h"
+
+namespace {
+	//Both shapes with the length of the first in front, so that ({ 2 }, { 3, 4 }) and ({ 2, 3 }, { 4 }) differ
+	typedef std::vector<int> PlanKey;
+
+	struct PlanKeyHash {
+		size_t operator()(const PlanKey& key) const
+		{
+			size_t hash = key.size();
+			for (int value : key) hash ^= std::hash<int>()(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+			return hash;
+		}
+	};
+
+	typedef std::list<std::pair<PlanKey, std::shared_ptr<const BroadcastPlan>>> PlanList;
+
+	struct PlanCache {
+		std::mutex mutex;
+		// Most recently used plans first
+		PlanList plans;
+		std::unordered_map<PlanKey, PlanList::iterator, PlanKeyHash> entries;
+		int capacity = 256;
+
+		void trim()
+		{
+			while ((int)plans.size() > capacity) {
+				entries.erase(plans.back().first);
+				plans.pop_back();
+			}
+		}
+	};
+
+	PlanCache& getCache()
+	{
+		static PlanCache cache;
+		return cache;
+	}
+
+	std::shared_ptr<const BroadcastPlan> createPlan(const std::vector<int>& shape1, const std::vector<int>& shape2)
+	{
+		auto plan = std::make_shared<BroadcastPlan>();
+		plan->shape = Tensor::broadcastShapes(shape1, shape2);
+		plan->strides = Tensor::calculateStrides(plan->shape);
+		plan->size = Tensor::calculateSize(plan->shape);
+
+		const std::vector<int>* shapes[2] = { &shape1, &shape2 };
+		int numDims = plan->shape.size();
+		for (int i = 0; i < 2; i++) {
+			int missingDims = numDims - shapes[i]->size();
+			for (int dim = 0; dim < numDims; dim++) {
+				if (dim < missingDims || ((*shapes[i])[dim - missingDims] == 1 && plan->shape[dim] != 1))
+					plan->reducedAxes[i].push_back(dim);
+			}
+		}
+		return plan;
+	}
+}
+
+std::shared_ptr<const BroadcastPlan> BroadcastPlan::get(const std::vector<int>& shape1, const std::vector<int>& shape2)
+{
+	PlanKey key;
+	key.reserve(shape1.size() + shape2.size() + 1);
+	key.push_back(shape1.size());
+	key.insert(key.end(), shape1.begin(), shape1.end());
+	key.insert(key.end(), shape2.begin(), shape2.end());
+
+	PlanCache& cache = getCache();
+	{
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		auto found = cache.entries.find(key);
+		if (found != cache.entries.end()) {
+			cache.plans.splice(cache.plans.begin(), cache.plans, found->second);
+			return found->second->second;
+		}
+	}
+
+	//Plans are built outside the lock, so two threads missing on the same key may both build one, and the first kept
+	std::shared_ptr<const BroadcastPlan> plan = createPlan(shape1, shape2);
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	auto found = cache.entries.find(key);
+	if (found != cache.entries.end()) {
+		cache.plans.splice(cache.plans.begin(), cache.plans, found->second);
+		return found->second->second;
+	}
+	cache.plans.emplace_front(key, plan);
+	cache.entries[key] = cache.plans.begin();
+	cache.trim();
+	return plan;
+}
+
+int BroadcastPlan::getCacheCapacity()
+{
+	PlanCache& cache = getCache();
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	return cache.capacity;
+}
+
+void BroadcastPlan::setCacheCapacity(int capacity)
+{
+	if (capacity < 0) throw std::invalid_argument("Capacity cannot be negative.");
+	PlanCache& cache = getCache();
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	cache.capacity = capacity;
+	cache.trim();
+}
+
+void BroadcastPlan::clearCache()
+{
+	PlanCache& cache = getCache();
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	cache.plans.clear();
+	cache.entries.clear();
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+// Result of broadcasting a pair of shapes against each other. Plans are kept in a least recently used cache shared by
+// every thread, so that the loops which run the same operations on the same shapes every step only look them up.
+struct BroadcastPlan {
+	std::vector<int> shape;
+	// Row-major strides of the broadcast shape
+	std::vector<int> strides;
+	int size;
+	// Dimensions of the broadcast shape which each operand is missing or has a size of 1 in while the broadcast shape
+	// does not. Summing a gradient over them, and dropping the missing ones, gives the shape of the operand.
+	std::vector<int> reducedAxes[2];
+
+	// Throws std::invalid_argument if the shapes cannot be broadcast, in which case nothing is cached
+	static std::shared_ptr<const BroadcastPlan> get(const std::vector<int>& shape1, const std::vector<int>& shape2);
+
+	// Number of plans kept before the least recently used one is dropped. Defaults to 256.
+	static int getCacheCapacity();
+	static void setCacheCapacity(int capacity);
+	static void clearCache();
+};
@@ -1,30 +1,151 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <stdexcept>
-#include <functional>
 #include <random>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
 
 #include "deep_learning.h"
+#include "broadcast_iterator.h"
+#include "broadcast_plan.h"
+#include "gemm.h"
+#include "simd.h"
+#include "lazy.h"
+#include "packed_weights.h"
+#include "thread_pool.h"
+
+namespace {
+	//Copies of the tensors created by the checkpointed layer running on this thread, which a deque holds without
+	//moving them, by the address of the tensor they were copied from
+	struct KeptIntermediates {
+		std::deque<Tensor>& tensors;
+		std::unordered_map<const Tensor*, Tensor*> copies;
+	};
+
+	thread_local KeptIntermediates* keptIntermediates = nullptr;
+
+	//Whether the tensor holds a single contiguous row which is broadcast along every other dimension
+	bool isRowVector(const Tensor& tensor, int rowSize)
+	{
+		const std::vector<int>& shape = tensor.getShape();
+		return tensor.getSize() == rowSize && !shape.empty() && shape.back() == rowSize && tensor.isContiguous();
+	}
+}
 
-Tensor::Tensor(const std::vector<int>& shape, int size, float* values) : shape(shape), size(size), values(values),
-requiresGrad(false), function(NULL)
+Tensor::Tensor(const std::vector<int>& shape, int size, float* values) :
+	Tensor(shape, size, std::make_shared<Storage>(values, size))
 {
 }
 
-Tensor::~Tensor()
+Tensor::Tensor(const std::vector<int>& shape, int size, const std::shared_ptr<Storage>& storage) : shape(shape),
+strides(calculateStrides(shape)), size(size), storage(storage), values(storage->getValues()), requiresGrad(false),
+function(nullptr), grad(nullptr), gradCleared(false)
 {
-	if (function != NULL) delete function;
+}
+
+Tensor Tensor::view(const std::vector<int>& shape, const std::vector<int>& strides, float* values) const
+{
+	Tensor newTensor(shape, calculateSize(shape), storage);
+	newTensor.strides = strides;
+	newTensor.values = values;
+	return newTensor;
+}
+
+Tensor Tensor::contiguous() const
+{
+	if (isContiguous()) return view(shape, strides, values);
+	return clone();
+}
+
+Tensor Tensor::clone() const
+{
+	realize();
+	auto newStorage = Storage::create(size);
+	float* newValues = newStorage->getValues();
+	BroadcastIterator iterator(shape, { this });
+	for (int i = 0; i < size; i++, iterator.next()) {
+		newValues[i] = values[iterator.getOffset(0)];
+	}
+	return Tensor(shape, size, newStorage);
+}
+
+Tensor Tensor::rowMajor() const
+{
+	if (strides.back() == 1) return view(shape, strides, values);
+	return contiguous();
+}
+
+Tensor Tensor::matrixView(bool& transposed, int& leadingDimension) const
+{
+	int dims = shape.size();
+	transposed = strides[dims - 1] != 1 && strides[dims - 2] == 1;
+	Tensor matrices = transposed ? view(shape, strides, values) : rowMajor();
+	leadingDimension = matrices.strides[dims - (transposed ? 1 : 2)];
+	return matrices;
+}
+
+void Tensor::materialize()
+{
+	if (size == 1 || !isConstant()) return;
+	auto newStorage = Storage::create(size);
+	newStorage->setCategory(storage->getCategory());
+	newStorage->setVersion(storage->getVersion());
+	std::fill(newStorage->getValues(), newStorage->getValues() + size, *values);
+	storage = newStorage;
+	values = newStorage->getValues();
+	strides = calculateStrides(shape);
+}
+
+void Tensor::realize() const
+{
+	if (storage->getPending()) LazyScope::run(storage);
+	//Tensors created before the buffer was allocated view it from its start
+	if (!values) values = storage->getValues();
 }
 
 const std::vector<int>& Tensor::getShape() const {
 	return shape;
 }
 
+const std::vector<int>& Tensor::getStrides() const {
+	return strides;
+}
+
 int Tensor::getSize() const {
 	return size;
 }
 
+bool Tensor::isContiguous() const {
+	int expectedStride = 1;
+	for (int i = shape.size() - 1; i >= 0; i--) {
+		if (shape[i] != 1 && strides[i] != expectedStride) return false;
+		expectedStride *= shape[i];
+	}
+	return true;
+}
+
+bool Tensor::isConstant() const {
+	for (int i = 0; i < shape.size(); i++) {
+		if (shape[i] != 1 && strides[i] != 0) return false;
+	}
+	return true;
+}
+
+int Tensor::getAlignment() const {
+	realize();
+	uintptr_t address = reinterpret_cast<uintptr_t>(values);
+	int alignment = 1;
+	while (alignment < tensorAlignment && address % (alignment * 2) == 0) alignment *= 2;
+	return alignment;
+}
+
+int Tensor::getLeadingDimension() const {
+	if (shape.size() < 2) return size;
+	return strides[shape.size() - 2];
+}
+
 bool Tensor::requiresGradient() const {
 	return requiresGrad;
 }
@@ -36,41 +157,72 @@ Tensor& Tensor::requireGradient() {
 
 float Tensor::item() const {
 	if (size > 1) throw std::length_error("Item can only be used on tensors of size 1.");
+	realize();
 	return values[0];
 }
 
 float Tensor::at(int index) const {
 	if (index < 0 || index >= size) throw std::out_of_range("Index must be within the range of the values.");
-	return values[index];
+	realize();
+	return values[getFlatOffset(index)];
 }
 
 float Tensor::at(const std::vector<int>& indices) const {
 	if (indices.size() < shape.size()) throw std::length_error("Number of indices cannot be less than number of dimensions.");
-	return values[getIndex(indices)];
+	realize();
+	return values[getOffset(indices)];
+}
+
+float* Tensor::getValues()
+{
+	realize();
+	materialize();
+	return values;
+}
+
+const float* Tensor::getValues() const
+{
+	realize();
+	return values;
 }
 
 const GradientFunction* Tensor::getFunction() const
 {
-	return function;
+	return function.get();
+}
+
+int Tensor::getVersion() const
+{
+	return storage->getVersion();
 }
 
 Tensor* Tensor::getGradient()
 {
-	return grad;
+	//Cleared buffers are only filled with zeroes once they are read. Intermediate gradients may share their values, so
+	//they are replaced with a constant instead.
+	if (gradCleared) {
+		if (function) grad = std::make_shared<Tensor>(zeroes(shape));
+		else std::fill(grad->values, grad->values + grad->size, 0.0f);
+		gradCleared = false;
+	}
+	return grad.get();
 }
 
 Tensor Tensor::detached() const
 {
-	float* newValues = new float[size];
-	for (int i = 0; i < size; i++)
-	{
-		newValues[i] = values[i];
-	}
-	return Tensor(shape, size, newValues);
+	return view(shape, strides, values);
+}
+
+void Tensor::backwards(bool retainGraph)
+{
+	backwards(ones(shape), retainGraph);
 }
 
-void Tensor::backwards() 
+void Tensor::backwards(const Tensor& gradient, bool retainGraph)
 {
+	if (gradient.shape != shape) throw std::invalid_argument("Gradient must have the same shape as the tensor.");
+	static const std::shared_ptr<GradientFunction> releasedFunction = std::make_shared<ReleasedFunction>();
+
 	std::unordered_map<Tensor*, int> dependencies{};
 	std::unordered_set<Tensor*> visited;
 	std::queue<Tensor*> initQueue{};
@@ -78,21 +230,21 @@ void Tensor::backwards()
 	dependencies.insert({ this, 0 });
 	initQueue.push(this);
 
-	// Discover all dependencies and create empty gradients
+	// Discover all dependencies and clear the gradients of intermediate tensors
 	while (!initQueue.empty())
 	{
 		Tensor* current = initQueue.front();
-		visited.insert(current);
 		initQueue.pop();
-
-		float* gradValues = new float[current->size];
-		for (int i = 0; i < current->size; i++) gradValues[i] = 0.0f;
-		current->grad = new Tensor(current->shape, current->size, gradValues);
+		//Tensors can be queued more than once before they are visited, but their dependents are only counted once
+		if (!visited.insert(current).second) continue;
 
 		const GradientFunction* func = current->getFunction();
+		if (func) current->clearGradient(false);
+		else if (!current->grad) current->clearGradient(true);
 		if (!func) continue;
 
 		for (Tensor* dependent : func->getDependents()) {
+			if (!dependent->requiresGrad) continue;
 			if (dependencies.find(dependent) == dependencies.end())
 				dependencies.insert({ dependent, 0 });
 			dependencies.at(dependent)++;
@@ -102,7 +254,7 @@ void Tensor::backwards()
 		}
 	}
 
-	*grad = add(*grad, 1.0f);
+	accumulateGradient(gradient);
 	std::queue<Tensor*> solveQueue{};
 	solveQueue.push(this);
 	while (!solveQueue.empty())
@@ -115,40 +267,137 @@ void Tensor::backwards()
 
 		if (current->function == nullptr) continue;
 
-		gradientList gradients = current->function->calculateGradient(*current->grad);
+		current->function->checkVersions();
+		gradientList gradients = current->function->calculateGradient(*current->getGradient());
+		if (!retainGraph) {
+			current->function = releasedFunction;
+			current->grad.reset();
+		}
 		for (gradientTuple tuple : gradients)
 		{
 			Tensor* dependent = std::get<0>(tuple);
 			Tensor& gradient = std::get<1>(tuple);
+			if (!dependent->requiresGrad) continue;
 
-			*dependent->grad = add(*dependent->grad, gradient);
+			dependent->accumulateGradient(gradient);
 			dependencies.at(dependent)--;
 			solveQueue.push(dependent);
 		}
 	}
 }
 
+void Tensor::zeroGrad()
+{
+	if (grad) gradCleared = true;
+}
+
+void Tensor::clearGradient(bool persistent)
+{
+	//Intermediate gradients are replaced by the first gradient accumulated into them rather than written to
+	if (!persistent) {
+		grad.reset();
+		gradCleared = false;
+		return;
+	}
+	if (!grad) {
+		//Leaf gradients are reused across steps, so they are kept out of any ArenaScope
+		auto newStorage = std::make_shared<Storage>(size);
+		newStorage->setCategory(MemoryCategory::Gradient);
+		grad = std::make_shared<Tensor>(Tensor(shape, size, newStorage));
+	}
+	gradCleared = true;
+}
+
+void Tensor::accumulateGradient(const Tensor& gradient)
+{
+	if (function) {
+		if (!grad || gradCleared) {
+			grad = std::make_shared<Tensor>(gradient.detached());
+			gradCleared = false;
+			return;
+		}
+		//The current gradient may belong to another tensor, so the sum is written to a new buffer
+		auto newStorage = Storage::create(size);
+		newStorage->setCategory(MemoryCategory::Gradient);
+		combine(*grad, gradient, shape, newStorage->getValues(), AddOperation());
+		grad = std::make_shared<Tensor>(Tensor(shape, size, newStorage));
+		return;
+	}
+
+	gradient.realize();
+	float* gradValues = grad->values;
+	if (gradient.isConstant()) {
+		float value = *gradient.values;
+		if (gradCleared) std::fill(gradValues, gradValues + size, value);
+		else for (int i = 0; i < size; i++) gradValues[i] += value;
+		gradCleared = false;
+		return;
+	}
+	Tensor contiguousGradient = gradient.contiguous();
+	const float* gradientValues = contiguousGradient.values;
+	if (gradCleared) {
+		std::copy(gradientValues, gradientValues + size, gradValues);
+		gradCleared = false;
+	}
+	else {
+		for (int i = 0; i < size; i++) gradValues[i] += gradientValues[i];
+	}
+}
+
+Tensor& Tensor::promote()
+{
+	if (storage->getArena() != nullptr) {
+		realize();
+		//Constants only move their single value
+		bool constant = isConstant();
+		int storedSize = constant ? 1 : size;
+		Tensor copy = constant ? detached() : contiguous();
+		auto newStorage = std::make_shared<Storage>(storedSize);
+		std::copy(copy.values, copy.values + storedSize, newStorage->getValues());
+		newStorage->setVersion(storage->getVersion());
+		storage = newStorage;
+		values = newStorage->getValues();
+		if (!constant) strides = calculateStrides(shape);
+	}
+	if (grad) grad->promote();
+	return *this;
+}
+
 Tensor& Tensor::reshape(const std::vector<int>& shape) {
 	int size = calculateSize(shape);
 	if (this->size != size) {
 		throw::std::length_error("New size does not match the current size.");
 	}
+	//Constants stay constant in any shape
+	if (isConstant()) {
+		this->shape = shape;
+		this->strides.assign(shape.size(), 0);
+		return *this;
+	}
+	//Views which are not laid out contiguously have to be copied before their strides can be recalculated
+	if (!isContiguous()) {
+		Tensor copy = contiguous();
+		copy.storage->setVersion(storage->getVersion());
+		this->storage = copy.storage;
+		this->values = copy.values;
+	}
 	this->shape = shape;
+	this->strides = calculateStrides(shape);
 	return *this;
 }
 
 Tensor Tensor::get(const std::vector<int>& indices) {
+	//Views can be written through, so they need values of their own to share
+	realize();
+	materialize();
 	int index = getIndex(indices);
-	std::vector<int> newShape(shape.begin() + indices.size(), shape.end());
+	std::vector<int> newShape = getSubShape(shape, indices.size(), 0);
+	std::vector<int> newStrides = getSubShape(strides, indices.size(), 0);
 	int newSize = calculateSize(newShape);
-	float* newValues = new float[newSize];
-	for (int i = 0; i < newSize; i++) {
-		newValues[i] = values[i + index];
-	}
-	Tensor newTensor(newShape, newSize, newValues);
+	Tensor newTensor = view(newShape, newStrides, values + getOffset(indices));
 	if (requiresGrad) {
 		newTensor.requiresGrad = true;
-		newTensor.function = new GetFunction(this, index, newSize);
+		newTensor.function = makeGradientFunction<GetFunction>(this, index, newSize);
 	}
 	return newTensor;
 }
@@ -159,16 +408,19 @@ Tensor Tensor::set(float value, const std::vector<int>& indices) {
 	std::vector<int> assignmentShape = getSubShape(shape, indices.size(), 0);
 	int assignmentSize = calculateSize(assignmentShape);
 
-	float* newValues = new float[size];
+	realize();
+	Tensor contiguousThis = contiguous();
+	auto newStorage = Storage::create(size);
+	float* newValues = newStorage->getValues();
 	for (int i = 0; i < size; i++) {
 		if (i - index >= 0 && i - index < assignmentSize) newValues[i] = value;
-		else newValues[i] = values[i];
+		else newValues[i] = contiguousThis.values[i];
 	}
 
-	Tensor newTensor(shape, size, newValues);
+	Tensor newTensor(shape, size, newStorage);
 	if (requiresGrad) {
 		newTensor.requiresGrad = true;
-		newTensor.function = new SetSingleFunction(this, index, assignmentSize);
+		newTensor.function = makeGradientFunction<SetSingleFunction>(this, index, assignmentSize);
 	}
 	return newTensor;
 }
@@ -181,23 +433,18 @@ Tensor Tensor::set(Tensor& values, const std::vector<int>& indices)
 	int assignmentSize = calculateSize(assignmentShape);
 
 	std::vector<int> broadcastedShape = broadcastShapes(values.shape, assignmentShape, true);
-	auto broadcastedIndices = broadcastIndices(values.shape, broadcastedShape);
 
-	float* newValues = new float[size];
-	for (int i = 0; i < size; i++) {
-		int assignmentIndex = i - index;
-		if (assignmentIndex >= 0 && assignmentIndex < assignmentSize) {
-			newValues[i] = values.at(broadcastedIndices[assignmentIndex]);
-		}
-		else {
-			newValues[i] = this->values[i];
-		}
+	values.realize();
+	Tensor newTensor = clone();
+	float* newValues = newTensor.values;
+	BroadcastIterator iterator(broadcastedShape, { &values });
+	for (int i = 0; i < assignmentSize; i++, iterator.next()) {
+		newValues[index + i] = values.values[iterator.getOffset(0)];
 	}
 
-	Tensor newTensor(shape, size, newValues);
 	if (requiresGrad || values.requiresGrad) {
 		newTensor.requiresGrad = true;
-		newTensor.function = new SetTensorFunction(this, &values, index, assignmentSize, broadcastedShape, broadcastedIndices);
+		newTensor.function = makeGradientFunction<SetTensorFunction>(this, &values, index, assignmentSize, broadcastedShape);
 	}
 	return newTensor;
 }
@@ -208,181 +455,312 @@ Tensor Tensor::transpose() {
 	if (numDims < 2) {
 		throw std::length_error("Must have at least 2 dimensions to transpose");
 	}
+	materialize();
 
-	int newSize = size;
-	auto newShape = getSubShape(shape, 0, 2);
-	newShape.push_back(shape[numDims - 1]);
-	newShape.push_back(shape[numDims - 2]);
-	int transposeSize = shape[numDims - 1] * shape[numDims - 2];
+	std::vector<int> newShape(shape), newStrides(strides);
+	std::swap(newShape[numDims - 1], newShape[numDims - 2]);
+	std::swap(newStrides[numDims - 1], newStrides[numDims - 2]);
 
-	float* newValues = new float[newSize];
-	std::vector<int> transposeIndices(newSize);
-
-	for (int i = 0; i < size; i += transposeSize)
-	{
-		for (int x = 0; x < shape[numDims - 1]; x++)
-		{
-			for (int y = 0; y < shape[numDims - 2]; y++)
-			{
-				int index1 = i + x + y * shape[numDims - 1];
-				int index2 = i + x * shape[numDims - 2] + y;
-#pragma warning(disable : 6386)
-				newValues[index2] = values[index1];
-				transposeIndices[index1] = index2;
-			}
-		}
-	}
-
-	Tensor newTensor(newShape, newSize, newValues);
+	Tensor newTensor = view(newShape, newStrides, values);
 	if (requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new TransposeFunction(this, transposeIndices);
+		newTensor.function = makeGradientFunction<TransposeFunction>(this);
 	}
 	return newTensor;
 }
 
-Tensor Tensor::add(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = input.values[i] + value;
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new AddSingleFunction(&input);
-	}
-	return newTensor;
+template<typename Operation>
+Tensor& Tensor::applyInPlace(Operation operation)
+{
+	//Operations recorded earlier have to read the values from before the write
+	LazyScope::flush();
+	realize();
+	materialize();
+	bool contiguous = isContiguous();
+	ThreadPool::parallelFor(size, [&](int begin, int end) {
+		if (contiguous) {
+			for (int i = begin; i < end; i++) values[i] = operation(values[i]);
+			return;
+		}
+		BroadcastIterator iterator(shape, { this });
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			float& value = values[iterator.getOffset(0)];
+			value = operation(value);
+		}
+	});
+	storage->incrementVersion();
+	return *this;
 }
 
-Tensor Tensor::add(Tensor& input, Tensor& other) {
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
+template<typename Operation>
+Tensor& Tensor::applyInPlace(const Tensor& other, Operation operation)
+{
+	std::vector<int> broadcastedShape = broadcastShapes(other.shape, shape, true);
+	LazyScope::flush();
+	realize();
+	other.realize();
+	materialize();
+
+	//Values which share storage with this tensor are copied so they are not overwritten before being read
+	Tensor source = other.storage == storage ? other.clone() : other.detached();
+	ThreadPool::parallelFor(size, [&](int begin, int end) {
+		BroadcastIterator iterator(broadcastedShape, { this, &source });
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			float& value = values[iterator.getOffset(0)];
+			value = operation(value, source.values[iterator.getOffset(1)]);
+		}
+	});
+	storage->incrementVersion();
+	return *this;
+}
 
-	float* newValues = new float[broadcastedSize];
+template<typename Operation>
+void Tensor::combine(const Tensor& input, const Tensor& other, const std::vector<int>& broadcastedShape, float* newValues,
+	Operation operation)
+{
+	input.realize();
+	other.realize();
+	int broadcastedSize = calculateSize(broadcastedShape);
+	int rowSize = broadcastedShape.empty() ? 1 : broadcastedShape.back();
+	bool inputFull = input.size == broadcastedSize && input.isContiguous();
+	bool otherFull = other.size == broadcastedSize && other.isContiguous();
+	const float* inputValues = input.values;
+	const float* otherValues = other.values;
+	forwardKernel kernel = getSimdKernels<Operation>().forward;
+
+	if (inputFull && otherFull) {
+		ThreadPool::parallelFor(broadcastedSize, [&](int begin, int end) {
+			if (kernel) kernel(inputValues + begin, 1, otherValues + begin, 1, newValues + begin, end - begin);
+			else for (int i = begin; i < end; i++) newValues[i] = operation(inputValues[i], otherValues[i]);
+		});
+	}
+	else if (inputFull && other.isConstant()) {
+		float y = *otherValues;
+		ThreadPool::parallelFor(broadcastedSize, [&](int begin, int end) {
+			if (kernel) kernel(inputValues + begin, 1, &y, 0, newValues + begin, end - begin);
+			else for (int i = begin; i < end; i++) newValues[i] = operation(inputValues[i], y);
+		});
+	}
+	else if (otherFull && input.isConstant()) {
+		float x = *inputValues;
+		ThreadPool::parallelFor(broadcastedSize, [&](int begin, int end) {
+			if (kernel) kernel(&x, 0, otherValues + begin, 1, newValues + begin, end - begin);
+			else for (int i = begin; i < end; i++) newValues[i] = operation(x, otherValues[i]);
+		});
+	}
+	else if ((inputFull && isRowVector(other, rowSize)) || (otherFull && isRowVector(input, rowSize))) {
+		//The row vector is read from the start of every row, and the full operand row by row
+		int inputRowStep = inputFull ? rowSize : 0, otherRowStep = otherFull ? rowSize : 0;
+		ThreadPool::parallelFor(broadcastedSize / rowSize, [&](int begin, int end) {
+			for (int row = begin; row < end; row++) {
+				const float* inputRow = inputValues + row * inputRowStep;
+				const float* otherRow = otherValues + row * otherRowStep;
+				float* newRow = newValues + row * rowSize;
+				if (kernel) kernel(inputRow, 1, otherRow, 1, newRow, rowSize);
+				else for (int j = 0; j < rowSize; j++) newRow[j] = operation(inputRow[j], otherRow[j]);
+			}
+		}, rowSize);
+	}
+	else {
+		ThreadPool::parallelFor(broadcastedSize, [&](int begin, int end) {
+			BroadcastIterator iterator(broadcastedShape, { &input, &other });
+			iterator.seek(begin);
+			for (int i = begin; i < end; i++, iterator.next()) {
+				newValues[i] = operation(inputValues[iterator.getOffset(0)], otherValues[iterator.getOffset(1)]);
+			}
+		});
+	}
+}
 
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = input.values[broadcastedIndices1[i]] + other.values[broadcastedIndices2[i]];
+template<typename Operation>
+Tensor Tensor::elementwise(Tensor& input, float value, Operation operation)
+{
+	//Size 1 results count as constants, so their value has to be known
+	if (input.isConstant()) input.realize();
+	if (input.isConstant()) {
+		Tensor newTensor = full(input.shape, operation(*input.values, value));
+		if (input.requiresGrad) {
+			newTensor.requiresGrad = true;
+			newTensor.function = makeGradientFunction<ElementwiseSingleFunction<Operation>>(&input, value, operation);
+		}
+		return newTensor;
+	}
+	if (LazyScope::isActive()) {
+		Tensor newTensor = LazyScope::record<Operation>(input, nullptr, value);
+		if (input.requiresGrad) {
+			newTensor.requiresGrad = true;
+			newTensor.function = makeGradientFunction<ElementwiseSingleFunction<Operation>>(&input, value, operation);
+		}
+		return newTensor;
 	}
 
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
+	input.realize();
+	auto newStorage = Storage::create(input.size);
+	float* newValues = newStorage->getValues();
+	forwardKernel kernel = getSimdKernels<Operation>().forward;
+	bool contiguous = input.isContiguous();
+	ThreadPool::parallelFor(input.size, [&](int begin, int end) {
+		if (contiguous && kernel) {
+			kernel(input.values + begin, 1, &value, 0, newValues + begin, end - begin);
+		}
+		else if (contiguous) {
+			for (int i = begin; i < end; i++) newValues[i] = operation(input.values[i], value);
+		}
+		else {
+			BroadcastIterator iterator(input.shape, { &input });
+			iterator.seek(begin);
+			for (int i = begin; i < end; i++, iterator.next()) newValues[i] = operation(input.values[iterator.getOffset(0)], value);
+		}
+	});
+
+	Tensor newTensor(input.shape, input.size, newStorage);
+	if (input.requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new AddTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
+		newTensor.function = makeGradientFunction<ElementwiseSingleFunction<Operation>>(&input, value, operation);
 	}
 	return newTensor;
 }
 
-Tensor Tensor::subtract(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = input.values[i] - value;
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
+template<typename Operation>
+Tensor Tensor::elementwise(Tensor& input, Tensor& other, Operation operation)
+{
+	std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(input.shape, other.shape);
+	const std::vector<int>& broadcastedShape = plan->shape;
+	if (input.isConstant()) input.realize();
+	if (other.isConstant()) other.realize();
+	Tensor newTensor = [&]() {
+		if (input.isConstant() && other.isConstant())
+			return full(broadcastedShape, operation(*input.values, *other.values));
+		if (LazyScope::isActive()) return LazyScope::record<Operation>(input, &other, 0.0f);
+
+		auto newStorage = Storage::create(plan->size);
+		combine(input, other, broadcastedShape, newStorage->getValues(), operation);
+		return Tensor(broadcastedShape, plan->size, newStorage);
+	}();
+	if (input.requiresGrad || other.requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new SubtractSingleFunction(&input);
+		newTensor.function = makeGradientFunction<ElementwiseFunction<Operation>>(&input, &other, operation);
 	}
 	return newTensor;
 }
 
-Tensor Tensor::subtract(Tensor& input, Tensor& other) {
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
+Tensor& Tensor::addInPlace(float value)
+{
+	return applyInPlace([value](float x) { return x + value; });
+}
 
-	float* newValues = new float[broadcastedSize];
+Tensor& Tensor::addInPlace(const Tensor& other)
+{
+	return applyInPlace(other, [](float x, float y) { return x + y; });
+}
 
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = input.values[broadcastedIndices1[i]] - other.values[broadcastedIndices2[i]];
-	}
+Tensor& Tensor::subtractInPlace(float value)
+{
+	return applyInPlace([value](float x) { return x - value; });
+}
 
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new SubtractTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
-	}
-	return newTensor;
+Tensor& Tensor::subtractInPlace(const Tensor& other)
+{
+	return applyInPlace(other, [](float x, float y) { return x - y; });
 }
 
-Tensor Tensor::multiply(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = input.values[i] * value;
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MultiplySingleFunction(&input, value);
-	}
-	return newTensor;
+Tensor& Tensor::multiplyInPlace(float value)
+{
+	return applyInPlace([value](float x) { return x * value; });
 }
 
-Tensor Tensor::multiply(Tensor& input, Tensor& other) {
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
+Tensor& Tensor::multiplyInPlace(const Tensor& other)
+{
+	return applyInPlace(other, [](float x, float y) { return x * y; });
+}
 
-	float* newValues = new float[broadcastedSize];
+Tensor& Tensor::fill(float value)
+{
+	return applyInPlace([value](float) { return value; });
+}
+
+Tensor& Tensor::copyFrom(const Tensor& other)
+{
+	return applyInPlace(other, [](float, float y) { return y; });
+}
 
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = input.values[broadcastedIndices1[i]] * other.values[broadcastedIndices2[i]];
+Tensor Tensor::padded() const
+{
+	if (shape.size() < 2) throw std::length_error("Only matrices can be padded.");
+	int numDims = shape.size();
+	int columns = shape[numDims - 1];
+	int alignedColumns = tensorAlignment / sizeof(float);
+	int leadingDimension = (columns + alignedColumns - 1) / alignedColumns * alignedColumns;
+
+	std::vector<int> newStrides(numDims);
+	newStrides[numDims - 1] = 1;
+	newStrides[numDims - 2] = leadingDimension;
+	for (int i = numDims - 3; i >= 0; i--) {
+		newStrides[i] = newStrides[i + 1] * shape[i + 1];
 	}
+	int paddedSize = size / columns * leadingDimension;
+	realize();
 
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MultiplyTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
+	auto newStorage = Storage::create(paddedSize);
+	float* newValues = newStorage->getValues();
+	for (int i = 0; i < paddedSize; i++) newValues[i] = 0;
+	for (int i = 0; i < size; i++) {
+		newValues[i / columns * leadingDimension + i % columns] = values[getFlatOffset(i)];
 	}
+	Tensor newTensor(shape, size, newStorage);
+	newTensor.strides = newStrides;
 	return newTensor;
 }
 
-Tensor Tensor::divide(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = input.values[i] / value;
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new DivideSingleFunction(&input, value);
-	}
-	return newTensor;
+Tensor Tensor::add(Tensor& input, float value) {
+	return elementwise(input, value, AddOperation());
 }
 
-Tensor Tensor::divide(Tensor& input, Tensor& other) {
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
+Tensor Tensor::add(Tensor& input, Tensor& other) {
+	return elementwise(input, other, AddOperation());
+}
 
-	float* newValues = new float[broadcastedSize];
+Tensor Tensor::subtract(Tensor& input, float value) {
+	return elementwise(input, value, SubtractOperation());
+}
 
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = input.values[broadcastedIndices1[i]] / other.values[broadcastedIndices2[i]];
-	}
+Tensor Tensor::subtract(Tensor& input, Tensor& other) {
+	return elementwise(input, other, SubtractOperation());
+}
 
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new DivideTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
-	}
-	return newTensor;
+Tensor Tensor::multiply(Tensor& input, float value) {
+	return elementwise(input, value, MultiplyOperation());
+}
+
+Tensor Tensor::multiply(Tensor& input, Tensor& other) {
+	return elementwise(input, other, MultiplyOperation());
+}
+
+Tensor Tensor::divide(Tensor& input, float value) {
+	return elementwise(input, value, DivideOperation());
+}
+
+Tensor Tensor::divide(Tensor& input, Tensor& other) {
+	return elementwise(input, other, DivideOperation());
 }
 
 Tensor Tensor::matrixMultiply(Tensor& input, Tensor& other)
+{
+	return matrixMultiply(input, other, nullptr);
+}
+
+Tensor Tensor::matrixMultiply(Tensor& input, PackedWeights& other)
+{
+	const PackedMatrix& packed = other.get();
+	return matrixMultiply(input, other.getWeights(), &packed);
+}
+
+Tensor Tensor::matrixMultiply(Tensor& input, Tensor& other, const PackedMatrix* packed)
 {
 	if (input.shape.size() < 2 || other.shape.size() < 2)
 		throw std::length_error("Tensors must have at least 2 dims for matrix multiplication.");
@@ -396,9 +774,7 @@ Tensor Tensor::matrixMultiply(Tensor& input, Tensor& other)
 	std::vector<int> beforeShape1 = getSubShape(input.shape, 0, 2);
 	std::vector<int> beforeShape2 = getSubShape(other.shape, 0, 2);
 
-	std::vector<int> broadcastedShape = broadcastShapes(beforeShape1, beforeShape2);
-	std::vector<int> broadcastedIndices1 = broadcastIndices(beforeShape1, broadcastedShape);
-	std::vector<int> broadcastedIndices2 = broadcastIndices(beforeShape2, broadcastedShape);
+	std::vector<int> broadcastedShape = BroadcastPlan::get(beforeShape1, beforeShape2)->shape;
 
 	int matrixWidth = matrixShape1[0];
 	int matrixInner = matrixShape1[1];
@@ -408,106 +784,70 @@ Tensor Tensor::matrixMultiply(Tensor& input, Tensor& other)
 	newShape.push_back(matrixWidth);
 	newShape.push_back(matrixHeight);
 	int newSize = calculateSize(newShape);
-	float* newValues = new float[newSize];
+	auto newStorage = Storage::create(newSize);
+	float* newValues = newStorage->getValues();
+	input.realize();
+	other.realize();
+
+	//Rows may be padded and transposed matrices are read as they are, so matrices are read through their leading dimensions
+	bool transposed1, transposed2 = false;
+	int leadingDimension1, leadingDimension2 = 0;
+	Tensor matrices1 = input.matrixView(transposed1, leadingDimension1);
+	Tensor matrices2 = packed ? other.view(other.shape, other.strides, other.values)
+		: other.matrixView(transposed2, leadingDimension2);
 
 	int broadcastedSize = calculateSize(broadcastedShape);
-	for (int i = 0; i < broadcastedSize; i++) {
-		int startIndex1 = broadcastedIndices1[i] * matrixWidth * matrixInner;
-		int startIndex2 = broadcastedIndices2[i] * matrixInner * matrixHeight;
-		for (int x = 0; x < matrixWidth; x++) {
-			for (int y = 0; y < matrixHeight; y++) {
-				float sum = 0;
-				for (int j = 0; j < matrixInner; j++) {
-					sum += input.values[startIndex1 + x * matrixInner + j] * other.values[startIndex2 + j * matrixHeight + y];
-				}
-				newValues[i * matrixWidth * matrixHeight + x * matrixHeight + y] = sum;
+	std::vector<int> batchStrides1 = getSubShape(matrices1.strides, 0, 2);
+	std::vector<int> batchStrides2 = getSubShape(matrices2.strides, 0, 2);
+	auto multiplyBatches = [&](int begin, int end) {
+		BroadcastIterator iterator(broadcastedShape, { beforeShape1, beforeShape2 }, { batchStrides1, batchStrides2 });
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			const float* matrix1 = matrices1.values + iterator.getOffset(0);
+			float* matrixOut = newValues + i * matrixWidth * matrixHeight;
+			if (packed) {
+				gemm(transposed1, matrixWidth, matrix1, leadingDimension1, *packed, matrixOut, matrixHeight);
+				continue;
 			}
+			const float* matrix2 = matrices2.values + iterator.getOffset(1);
+			gemm(transposed1, transposed2, matrixWidth, matrixHeight, matrixInner, matrix1, leadingDimension1, matrix2,
+				leadingDimension2, matrixOut, matrixHeight);
 		}
+	};
+	//With a batch for every thread each matrix is multiplied on one thread, and otherwise gemm splits every matrix
+	if (broadcastedSize >= ThreadPool::getNumThreads()) {
+		long long matrixWork = (long long)matrixWidth * matrixInner * matrixHeight;
+		ThreadPool::parallelFor(broadcastedSize, multiplyBatches, (int)std::min<long long>(matrixWork, INT_MAX));
+	}
+	else {
+		multiplyBatches(0, broadcastedSize);
 	}
 
-	Tensor newTensor(newShape, newSize, newValues);
+	Tensor newTensor(newShape, newSize, newStorage);
 	if (input.requiresGrad || other.requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new MatrixMultiplicationFunction(
-			&input, &other, broadcastedIndices1, broadcastedIndices2, matrixWidth, matrixInner, matrixHeight
+		newTensor.function = makeGradientFunction<MatrixMultiplicationFunction>(
+			&input, &other, matrixWidth, matrixInner, matrixHeight
 		);
 	}
 	return newTensor;
 }
 
 Tensor Tensor::max(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = std::max(input.values[i], value);
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MaxSingleFunction(&input, value);
-	}
-	return newTensor;
+	return elementwise(input, value, MaxOperation());
 }
 
-Tensor Tensor::max(Tensor& input, Tensor& other)
-{
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
-
-
-	float* newValues = new float[broadcastedSize];
-
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = std::max(input.values[broadcastedIndices1[i]], other.values[broadcastedIndices2[i]]);
-	}
-
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MaxTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
-	}
-	return newTensor;
+Tensor Tensor::max(Tensor& input, Tensor& other) {
+	return elementwise(input, other, MaxOperation());
 }
 
 Tensor Tensor::min(Tensor& input, float value) {
-	float* other = new float[input.size];
-	for (int i = 0; i < input.size; i++) {
-		other[i] = std::min(input.values[i], value);
-	}
-	Tensor newTensor(input.shape, input.size, other);
-	if (input.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MinSingleFunction(&input, value);
-	}
-	return newTensor;
+	return elementwise(input, value, MinOperation());
 }
 
-Tensor Tensor::min(Tensor& input, Tensor& other)
-{
-	auto broadcastedShape = broadcastShapes(input.shape, other.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(other.shape, broadcastedShape);
-
-
-	float* newValues = new float[broadcastedSize];
-
-	for (int i = 0; i < broadcastedSize; i++) {
-		newValues[i] = std::min(input.values[broadcastedIndices1[i]], other.values[broadcastedIndices2[i]]);
-	}
-
-	Tensor newTensor(broadcastedShape, broadcastedSize, newValues);
-	if (input.requiresGrad || other.requiresGrad)
-	{
-		newTensor.requiresGrad = true;
-		newTensor.function = new MinTensorFunction(&input, &other, broadcastedIndices1, broadcastedIndices2);
-	}
-	return newTensor;
+Tensor Tensor::min(Tensor& input, Tensor& other) {
+	return elementwise(input, other, MinOperation());
 }
 
 Tensor Tensor::ReLU(Tensor& input)
@@ -517,78 +857,146 @@ Tensor Tensor::ReLU(Tensor& input)
 
 Tensor Tensor::meanSquaredErrorLoss(Tensor& input, Tensor& target)
 {
-	auto broadcastedShape = broadcastShapes(input.shape, target.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(target.shape, broadcastedShape);
-
-	float* newValue = new float;
-	*newValue = 0;
-
-	for (int i = 0; i < broadcastedSize; i++)
-	{
-		float diff = input.values[broadcastedIndices1[i]] - target.values[broadcastedIndices1[i]];
-		*newValue += diff * diff;
-	}
+	std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(input.shape, target.shape);
+	const std::vector<int>& broadcastedShape = plan->shape;
+	int broadcastedSize = plan->size;
+
+	input.realize();
+	target.realize();
+	auto newStorage = Storage::create(1);
+	float* newValue = newStorage->getValues();
+	*newValue = ThreadPool::parallelSum(broadcastedSize, [&](int begin, int end) {
+		BroadcastIterator iterator(broadcastedShape, { &input, &target });
+		iterator.seek(begin);
+		float sum = 0;
+		for (int i = begin; i < end; i++, iterator.next()) {
+			float diff = input.values[iterator.getOffset(0)] - target.values[iterator.getOffset(1)];
+			sum += diff * diff;
+		}
+		return sum;
+	});
 	*newValue /= broadcastedSize;
 
-	Tensor newTensor = Tensor({}, 1, newValue);
+	Tensor newTensor = Tensor({}, 1, newStorage);
 	if (input.requiresGrad || target.requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new MeanSquaredErrorLossFunction(&input, &target, broadcastedSize, broadcastedIndices1, broadcastedIndices2);
+		newTensor.function = makeGradientFunction<MeanSquaredErrorLossFunction>(&input, &target, broadcastedSize);
 	}
 	return newTensor;
 }
 
 Tensor Tensor::categoricalCrossEntropyLoss(Tensor& input, const Tensor& target)
 {
+	input.realize();
+	target.realize();
+	Tensor contiguousInput = input.contiguous();
 	int finalDimSize = input.shape[input.shape.size() - 1];
 
 	if (finalDimSize < 2)
 		throw std::length_error("Input final dimension must be greater than 1.");
 
-	float* softmaxValues = new float[input.size];
-	for (int i = 0; i < input.size / finalDimSize; i++) {
-		float sum = 0;
-		for (int j = 0; j < finalDimSize; j++) {
-			int index = finalDimSize * i + j;
-			float exp = std::exp(input.values[index]);
-			softmaxValues[index] = exp;
-			sum += exp;
-		}
-		int x = 5;
-		for (int j = 0; j < finalDimSize; j++) {
-			int index = finalDimSize * i + j;
+	auto softmaxStorage = Storage::create(input.size);
+	softmaxStorage->setCategory(MemoryCategory::Saved);
+	float* softmaxValues = softmaxStorage->getValues();
+	ThreadPool::parallelFor(input.size / finalDimSize, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			float sum = 0;
+			for (int j = 0; j < finalDimSize; j++) {
+				int index = finalDimSize * i + j;
+				float exp = std::exp(contiguousInput.values[index]);
+				softmaxValues[index] = exp;
+				sum += exp;
+			}
+			for (int j = 0; j < finalDimSize; j++) {
+				int index = finalDimSize * i + j;
 #pragma warning(disable : 6385)
-			softmaxValues[index] /= sum;
+				softmaxValues[index] /= sum;
+			}
 		}
-	}
+	}, finalDimSize);
 
-	float* newValue = new float;
-	*newValue = 0.0f;
+	auto newStorage = Storage::create(1);
+	float* newValue = newStorage->getValues();
 
-	auto broadcastedShape = broadcastShapes(input.shape, target.shape);
-	int broadcastedSize = calculateSize(broadcastedShape);
-	auto broadcastedIndices1 = broadcastIndices(input.shape, broadcastedShape);
-	auto broadcastedIndices2 = broadcastIndices(target.shape, broadcastedShape);
+	std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(input.shape, target.shape);
+	const std::vector<int>& broadcastedShape = plan->shape;
+	int broadcastedSize = plan->size;
 
-	for (int i = 0; i < broadcastedSize; i++) {
+	//The softmax values are laid out contiguously in the shape of the input
+	std::vector<int> softmaxStrides = calculateStrides(input.shape);
+	*newValue = ThreadPool::parallelSum(broadcastedSize, [&](int begin, int end) {
+		BroadcastIterator iterator(broadcastedShape, { input.shape, target.shape }, { softmaxStrides, target.strides });
+		iterator.seek(begin);
+		float sum = 0;
+		for (int i = begin; i < end; i++, iterator.next()) {
 #pragma warning(disable : 6001)
-		* newValue -= target.values[broadcastedIndices2[i]] * std::log(softmaxValues[broadcastedIndices1[i]]);
-	}
+			sum -= target.values[iterator.getOffset(1)] * std::log(softmaxValues[iterator.getOffset(0)]);
+		}
+		return sum;
+	});
 	*newValue /= (broadcastedSize / finalDimSize);
 
-	Tensor newTensor = Tensor({}, 1, newValue);
+	Tensor newTensor = Tensor({}, 1, newStorage);
 	if (input.requiresGrad)
 	{
 		newTensor.requiresGrad = true;
-		newTensor.function = new CategoricalCrossEntropyLossFunction(&input, &target, softmaxValues, finalDimSize,
-			broadcastedSize, broadcastedIndices1, broadcastedIndices2);
+		newTensor.function = makeGradientFunction<CategoricalCrossEntropyLossFunction>(&input, &target, softmaxStorage, finalDimSize,
+			broadcastedSize);
 	}
 	return newTensor;
 }
 
+Tensor Tensor::checkpoint(const std::vector<layerFunction>& layers, Tensor& input)
+{
+	//Each output is detached as soon as it is produced, so only the current one is kept alive
+	Tensor output = input.detached();
+	bool requiresGrad = input.requiresGrad;
+	for (const layerFunction& layer : layers) {
+		std::deque<Tensor> intermediates;
+		Tensor layerOutput = runLayer(layer, output, intermediates);
+		requiresGrad = requiresGrad || layerOutput.requiresGrad;
+		output = layerOutput.detached();
+	}
+
+	if (requiresGrad) {
+		output.requiresGrad = true;
+		output.function = makeGradientFunction<CheckpointFunction>(&input, layers);
+	}
+	return output;
+}
+
+Tensor Tensor::runLayer(const layerFunction& layer, Tensor& input, std::deque<Tensor>& intermediates)
+{
+	//Layers of nested checkpoints keep their tensors in their own intermediates
+	struct KeepScope {
+		KeptIntermediates kept;
+		KeptIntermediates* previous;
+		KeepScope(std::deque<Tensor>& intermediates) : kept{ intermediates, {} }, previous(keptIntermediates) { keptIntermediates = &kept; }
+		~KeepScope() { keptIntermediates = previous; }
+	} scope(intermediates);
+	return layer(input);
+}
+
+Tensor* keepDependent(const Tensor* tensor)
+{
+	//Leaves which need a gradient, such as weights, live outside the layer and collect their gradients themselves
+	if (!keptIntermediates || (tensor->requiresGrad && !tensor->function)) return const_cast<Tensor*>(tensor);
+	//The address of a tensor which has been destroyed can be reused, so earlier copies are only shared if they still match
+	Tensor*& copy = keptIntermediates->copies[tensor];
+	if (!copy || copy->storage != tensor->storage || copy->values != tensor->values || copy->function != tensor->function ||
+		copy->shape != tensor->shape || copy->strides != tensor->strides) {
+		keptIntermediates->tensors.push_back(*tensor);
+		copy = &keptIntermediates->tensors.back();
+	}
+	return copy;
+}
+
+Tensor Tensor::empty(const std::vector<int>& shape) {
+	int size = calculateSize(shape);
+	return Tensor(shape, size, Storage::create(size));
+}
+
 Tensor Tensor::zeroes(const std::vector<int>& shape) {
 	return full(shape, 0.0f);
 }
@@ -600,32 +1008,42 @@ Tensor Tensor::ones(const std::vector<int>& shape) {
 Tensor Tensor::full(const std::vector<int>& shape, float value)
 {
 	int size = calculateSize(shape);
-	float* values = new float[size];
-	for (int i = 0; i < size; i++) {
-		values[i] = value;
-	}
-	return Tensor(shape, size, values);
+	auto newStorage = Storage::create(1);
+	*newStorage->getValues() = value;
+	Tensor newTensor(shape, size, newStorage);
+	newTensor.strides.assign(shape.size(), 0);
+	return newTensor;
 }
 
 Tensor Tensor::range(const std::vector<int>& shape, float start, float step)
 {
 	int size = calculateSize(shape);
-	float* values = new float[size];
+	auto newStorage = Storage::create(size);
+	float* values = newStorage->getValues();
 	for (int i = 0; i < size; i++) {
 		values[i] = start + i * step;
 	}
-	return Tensor(shape, size, values);
+	return Tensor(shape, size, newStorage);
 }
 
 Tensor Tensor::fromValues(float* values, const std::vector<int>& shape)
 {
-	return Tensor(shape, calculateSize(shape), values);
+	//Take ownership first so the buffer is still released if the shape is invalid
+	std::unique_ptr<float[]> ownedValues(values);
+	int size = calculateSize(shape);
+	if (reinterpret_cast<uintptr_t>(values) % tensorAlignment == 0) return Tensor(shape, size, ownedValues.release());
+
+	//Move unaligned buffers into aligned storage
+	auto newStorage = Storage::create(size);
+	std::copy(values, values + size, newStorage->getValues());
+	return Tensor(shape, size, newStorage);
 }
 
 Tensor Tensor::uniform(const std::vector<int>& shape, float min, float max)
 {
 	int size = calculateSize(shape);
-	float* values = new float[size];
+	auto newStorage = Storage::create(size);
+	float* values = newStorage->getValues();
 	std::random_device rd;
 	std::mt19937 gen(rd());
 	std::uniform_real_distribution<> dist(min, max);
@@ -633,13 +1051,14 @@ Tensor Tensor::uniform(const std::vector<int>& shape, float min, float max)
 	{
 		values[i] = dist(gen);
 	}
-	return Tensor(shape, size, values);
+	return Tensor(shape, size, newStorage);
 }
 
 Tensor Tensor::normal(const std::vector<int>& shape, float mean, float std)
 {
 	int size = calculateSize(shape);
-	float* values = new float[size];
+	auto newStorage = Storage::create(size);
+	float* values = newStorage->getValues();
 	std::random_device rd;
 	std::mt19937 gen(rd());
 	std::normal_distribution<> dist(mean, std);
@@ -647,15 +1066,18 @@ Tensor Tensor::normal(const std::vector<int>& shape, float mean, float std)
 	{
 		values[i] = dist(gen);
 	}
-	return Tensor(shape, size, values);
+	return Tensor(shape, size, newStorage);
 }
 
-int Tensor::getIndex(const std::vector<int>& indices) const {
-	//Ensure indices are valid
+void Tensor::validateIndices(const std::vector<int>& indices) const {
 	if (indices.size() > shape.size()) throw std::length_error("Number of indices cannot be greater than number of dimensions.");
 	for (int i = 0; i < indices.size(); i++) {
 		if (indices[i] >= shape[i] || indices[i] < 0) throw std::out_of_range("Index is not in the range of the tensor.");
 	}
+}
+
+int Tensor::getIndex(const std::vector<int>& indices) const {
+	validateIndices(indices);
 
 	//Calculate starting index
 	std::vector<int> fullIndices(indices);
@@ -670,6 +1092,25 @@ int Tensor::getIndex(const std::vector<int>& indices) const {
 	return index;
 }
 
+int Tensor::getOffset(const std::vector<int>& indices) const {
+	validateIndices(indices);
+
+	int offset = 0;
+	for (int i = 0; i < indices.size(); i++) {
+		offset += indices[i] * strides[i];
+	}
+	return offset;
+}
+
+int Tensor::getFlatOffset(int index) const {
+	int offset = 0;
+	for (int i = shape.size() - 1; i >= 0; i--) {
+		offset += (index % shape[i]) * strides[i];
+		index /= shape[i];
+	}
+	return offset;
+}
+
 int Tensor::calculateSize(const std::vector<int>& shape) {
 	int size = 1;
 	for (int dim : shape) {
@@ -679,6 +1120,16 @@ int Tensor::calculateSize(const std::vector<int>& shape) {
 	return size;
 }
 
+std::vector<int> Tensor::calculateStrides(const std::vector<int>& shape) {
+	std::vector<int> strides(shape.size());
+	int stride = 1;
+	for (int i = shape.size() - 1; i >= 0; i--) {
+		strides[i] = stride;
+		stride *= shape[i];
+	}
+	return strides;
+}
+
 std::vector<int> Tensor::getSubShape(const std::vector<int>& shape, int frontRemoval, int endRemoval)
 {
 	return std::vector<int>(shape.begin() + frontRemoval, shape.end() - endRemoval);
@@ -696,39 +1147,4 @@ std::vector<int> Tensor::broadcastShapes(std::vector<int> shape1, std::vector<in
 		else if (shape2[i] != 1) throw std::invalid_argument("Smaller dimension must have a size of 1.");
 	}
 	return shape1;
-}
-
-std::vector<int> Tensor::broadcastIndices(std::vector<int> originalShape, const std::vector<int>& broadcastedShape)
-{
-	while (broadcastedShape.size() > originalShape.size()) originalShape.insert(originalShape.begin(), 1);
-	std::vector<int> originalShapeStrides(originalShape.size()), broadcastedShapeStrides(originalShape.size());
-	{
-		int originalShapeStride = 1, broadcastedShapeStride = 1;
-		for (int i = originalShape.size() - 1; i >= 0; i--) {
-			if (originalShape[i] == 1) broadcastedShapeStrides[i] = 0;
-			else broadcastedShapeStrides[i] = originalShapeStride;
-			originalShapeStrides[i] = broadcastedShapeStride;
-			originalShapeStride *= originalShape[i];
-			broadcastedShapeStride *= broadcastedShape[i];
-		}
-	}
-
-	std::vector<int> broadcastedIndices(calculateSize(broadcastedShape));
-
-	std::function<void(int, int, int)> recursiveIterate = [&](int depth, int trueIndex, int broadcastedIndex) {
-		if (depth == originalShapeStrides.size()) {
-			broadcastedIndices[trueIndex] = broadcastedIndex;
-			return;
-		}
-		for (int i = 0; i < broadcastedShape[depth]; i++) {
-			recursiveIterate(depth + 1,
-				trueIndex + i * originalShapeStrides[depth],
-				broadcastedIndex + i * broadcastedShapeStrides[depth]);
-		}
-	};
-
-	if (originalShape.size() == 0) broadcastedIndices[0] = 0;
-	else recursiveIterate(0, 0, 0);
-
-	return broadcastedIndices;
 }
\ No newline at end of file
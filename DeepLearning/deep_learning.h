@@ -1,41 +1,119 @@
-#pragma 
+#pragma once
 #include <vector>
+#include <deque>
+#include <memory>
 
 #include "gradient_function.h"
+#include "storage.h"
+
+class PackedMatrix;
+class PackedWeights;
 
 class Tensor {
 private:
 	std::vector<int> shape;
+	std::vector<int> strides;
 	int size;
-	float* values;
+	std::shared_ptr<Storage> storage;
+	// Null for the outputs of a LazyScope, and views taken of them, until realize finds the values allocated
+	mutable float* values;
 	bool requiresGrad;
-	GradientFunction* function;
-	Tensor* grad;
+	std::shared_ptr<GradientFunction> function;
+	std::shared_ptr<Tensor> grad;
+	bool gradCleared;
 
 	Tensor(const std::vector<int>& shape, int size, float* values);
+	Tensor(const std::vector<int>& shape, int size, const std::shared_ptr<Storage>& storage);
+
+	Tensor view(const std::vector<int>& shape, const std::vector<int>& strides, float* values) const;
+	Tensor contiguous() const;
+	Tensor clone() const;
+	Tensor rowMajor() const;
+	// Tensor whose matrices gemm can read in place, either row by row or as the transpose of row-major matrices.
+	// Sets whether they are transposed and the leading dimension to read them through.
+	Tensor matrixView(bool& transposed, int& leadingDimension) const;
+	// Gives a constant tensor its own buffer holding every element, so that it can be written to
+	void materialize();
+	// Runs the operation recorded by a LazyScope for the storage, if its values have not been written yet, and
+	// points values at the buffer it was given
+	void realize() const;
 
+	void validateIndices(const std::vector<int>& indices) const;
 	int getIndex(const std::vector<int>& indices) const;
+	int getOffset(const std::vector<int>& indices) const;
+	int getFlatOffset(int index) const;
+
+	template<typename Operation> Tensor& applyInPlace(Operation operation);
+	template<typename Operation> Tensor& applyInPlace(const Tensor& other, Operation operation);
+	// Writes operation(input, other) for every element of the broadcast shape. Same-shape, scalar and row-vector
+	// operands which are contiguous are handled by straight-line loops, and everything else by a BroadcastIterator.
+	template<typename Operation> static void combine(const Tensor& input, const Tensor& other,
+		const std::vector<int>& broadcastedShape, float* newValues, Operation operation);
+	// Applies an operation from elementwise.h and records its gradient function
+	template<typename Operation> static Tensor elementwise(Tensor& input, float value, Operation operation);
+	template<typename Operation> static Tensor elementwise(Tensor& input, Tensor& other, Operation operation);
+	// Multiplies through gemm, reading other from packed instead if it is not null
+	static Tensor matrixMultiply(Tensor& input, Tensor& other, const PackedMatrix* packed);
+
+	void clearGradient(bool persistent);
+	void accumulateGradient(const Tensor& gradient);
+
+	// Runs a checkpointed layer, adding copies of the tensors its gradient functions refer to to intermediates
+	static Tensor runLayer(const layerFunction& layer, Tensor& input, std::deque<Tensor>& intermediates);
+	friend Tensor* keepDependent(const Tensor* tensor);
+	friend class CheckpointFunction;
 
+	// Defined in expression.h, and records the gradient function of an expression on its result
+	template<typename Expression> friend Tensor evaluate(const Expression& expression);
+	friend class LazyScope;
+	friend class MatrixMultiplicationFunction;
+	friend class PackedWeights;
+public:
 	static int calculateSize(const std::vector<int>& shape);
+	static std::vector<int> calculateStrides(const std::vector<int>& shape);
 	static std::vector<int> getSubShape(const std::vector<int>& shape, int frontRemoval, int endRemoval);
 	static std::vector<int> broadcastShapes(std::vector<int> shape0, std::vector<int> shape1, bool oneWay = false);
-	static std::vector<int> broadcastIndices(std::vector<int> originalShape, const std::vector<int>& broadcastedShape);
-public:
-	~Tensor();
 
 	const std::vector<int>& getShape() const;
+	const std::vector<int>& getStrides() const;
 	int getSize() const;
+	bool isContiguous() const;
+	// Whether every element is read from the same value, as in the tensors made by full, zeroes and ones. Those store
+	// one value with strides of 0, and only allocate the rest once something writes to them or takes a view with get
+	// or transpose. Detached copies taken beforehand keep reading the constant.
+	bool isConstant() const;
+	// Largest power of two up to tensorAlignment which the address of the first value is a multiple of, in bytes
+	int getAlignment() const;
+	// Distance between the starts of consecutive rows of a matrix, in values
+	int getLeadingDimension() const;
 	bool requiresGradient() const;
 	Tensor& requireGradient();
 	float item() const;
 	float at(int index) const;
 	float at(const std::vector<int>& indices) const;
+	// Materializes constant tensors, which the const overload does not
+	float* getValues();
+	const float* getValues() const;
 	const GradientFunction* getFunction() const;
+	// Number of in-place modifications made to the storage behind this tensor
+	int getVersion() const;
 	Tensor* getGradient();
 
 	Tensor detached() const;
 
-	void backwards();
+	// Adds the gradient of this tensor to the gradient buffers of every tensor it depends on which requires one.
+	// Leaf tensors keep their buffer between calls and accumulate into it until zeroGrad is called.
+	// Intermediate tensors hold the first gradient they receive as it is, without copying it into a buffer, so their
+	// gradients may share values with other gradients. The gradient backwards starts from is a constant.
+	// Unless retainGraph is set, the gradient functions and intermediate gradients are freed as they are used.
+	void backwards(bool retainGraph = false);
+	// Backpropagates the given gradient of this tensor instead of ones
+	void backwards(const Tensor& gradient, bool retainGraph = false);
+	// Clears the accumulated gradient without releasing its buffer
+	void zeroGrad();
+
+	// Moves values allocated in an ArenaScope, and the gradient, to memory which outlives the scope
+	Tensor& promote();
 
 	Tensor& reshape(const std::vector<int>& shape);
 
@@ -44,6 +122,20 @@ public:
 	Tensor set(Tensor& values, const std::vector<int>& indices = {});
 	Tensor transpose();
 
+	// In-place operations write into the values of this tensor, broadcasting the other tensor to its shape.
+	// They are not recorded for gradients, and backwards throws if a tensor it needs was modified by one.
+	Tensor& addInPlace(float value);
+	Tensor& addInPlace(const Tensor& other);
+	Tensor& subtractInPlace(float value);
+	Tensor& subtractInPlace(const Tensor& other);
+	Tensor& multiplyInPlace(float value);
+	Tensor& multiplyInPlace(const Tensor& other);
+	Tensor& fill(float value);
+	Tensor& copyFrom(const Tensor& other);
+	// Copies a matrix, or batch of matrices, into a buffer where every row starts on a tensorAlignment boundary
+	Tensor padded() const;
+
+	// Constant operands are read as a single value, and the result of two constants is a constant
 	static Tensor add(Tensor& input, float other);
 	static Tensor add(Tensor& input, Tensor& other);
 	static Tensor subtract(Tensor& input, float value);
@@ -53,6 +145,8 @@ public:
 	static Tensor divide(Tensor& input, float value);
 	static Tensor divide(Tensor& input, Tensor& other);
 	static Tensor matrixMultiply(Tensor& input, Tensor& other);
+	// Multiplies by weights which are kept packed between calls, which gives the same result and gradients
+	static Tensor matrixMultiply(Tensor& input, PackedWeights& other);
 	static Tensor max(Tensor& input, float other);
 	static Tensor max(Tensor& input, Tensor& other);
 	static Tensor min(Tensor& input, float other);
@@ -63,6 +157,13 @@ public:
 	static Tensor meanSquaredErrorLoss(Tensor& input, Tensor& targets);
 	static Tensor categoricalCrossEntropyLoss(Tensor& input, const Tensor& target);
 
+	// Runs the layers in order without keeping their intermediate outputs, which are recomputed when backwards
+	// reaches the result. Layers may apply several operations, as every tensor they create is kept alive until its
+	// gradients have been computed. Any other tensors they use, such as weights, must be leaves which live outside
+	// the layers and are not modified before backwards.
+	static Tensor checkpoint(const std::vector<layerFunction>& layers, Tensor& input);
+
+	static Tensor empty(const std::vector<int>& shape);
 	static Tensor zeroes(const std::vector<int>& shape);
 	static Tensor ones(const std::vector<int>& shape);
 	static Tensor full(const std::vector<int>& shape, float value);
@@ -0,0 +1,70 @@
+#pragma once
+
+// Elementwise operations shared by the forward kernels and ElementwiseFunction. Each gives its value and its partial
+// derivatives with respect to both operands. Operations with a constant receive it as the second operand.
+// savesInputs is false when the derivatives do not read the operands, so they are not version checked, and
+// savesInputWithConstant is the same for derivative1 alone, which is all an operation with a constant needs.
+// The members are templates so the same definitions are used on floats and on the SIMD vectors in simd_kernels.h,
+// which provide the arithmetic operators and the helpers below.
+
+inline float maximum(float x, float y) { return x < y ? y : x; }
+inline float minimum(float x, float y) { return y < x ? y : x; }
+// value where x >= y, otherwise zero
+inline float ifGreaterEqual(float x, float y, float value) { return x >= y ? value : 0.0f; }
+
+struct AddOperation {
+	static const bool savesInputs = false;
+	static const bool savesInputWithConstant = false;
+	template<typename T> T operator()(T x, T y) const { return x + y; }
+	template<typename T> T derivative1(T, T) const { return T(1.0f); }
+	template<typename T> T derivative2(T, T) const { return T(1.0f); }
+};
+
+struct SubtractOperation {
+	static const bool savesInputs = false;
+	static const bool savesInputWithConstant = false;
+	template<typename T> T operator()(T x, T y) const { return x - y; }
+	template<typename T> T derivative1(T, T) const { return T(1.0f); }
+	template<typename T> T derivative2(T, T) const { return T(-1.0f); }
+};
+
+struct MultiplyOperation {
+	static const bool savesInputs = true;
+	static const bool savesInputWithConstant = false;
+	template<typename T> T operator()(T x, T y) const { return x * y; }
+	template<typename T> T derivative1(T, T y) const { return y; }
+	template<typename T> T derivative2(T x, T) const { return x; }
+};
+
+struct DivideOperation {
+	static const bool savesInputs = true;
+	static const bool savesInputWithConstant = false;
+	template<typename T> T operator()(T x, T y) const { return x / y; }
+	template<typename T> T derivative1(T, T y) const { return T(1.0f) / y; }
+	template<typename T> T derivative2(T x, T y) const { return -x / (y * y); }
+};
+
+struct MaxOperation {
+	static const bool savesInputs = true;
+	static const bool savesInputWithConstant = true;
+	template<typename T> T operator()(T x, T y) const { return maximum(x, y); }
+	template<typename T> T derivative1(T x, T y) const { return ifGreaterEqual(x, y, T(1.0f)); }
+	template<typename T> T derivative2(T x, T y) const { return ifGreaterEqual(y, x, T(1.0f)); }
+};
+
+struct MinOperation {
+	static const bool savesInputs = true;
+	static const bool savesInputWithConstant = true;
+	template<typename T> T operator()(T x, T y) const { return minimum(x, y); }
+	template<typename T> T derivative1(T x, T y) const { return ifGreaterEqual(y, x, T(1.0f)); }
+	template<typename T> T derivative2(T x, T y) const { return ifGreaterEqual(x, y, T(1.0f)); }
+};
+
+// Calls X once for each operation, for the files which instantiate a template per operation
+#define ELEMENTWISE_OPERATIONS(X) \
+	X(AddOperation) \
+	X(SubtractOperation) \
+	X(MultiplyOperation) \
+	X(DivideOperation) \
+	X(MaxOperation) \
+	X(MinOperation)
@@ -0,0 +1,302 @@
+#pragma once
+#include <vector>
+#include <type_traits>
+
+#include "deep_learning.h"
+#include "broadcast_iterator.h"
+#include "broadcast_plan.h"
+#include "thread_pool.h"
+
+// Expression templates for chains of elementwise operations. The operators below build an expression instead of a
+// tensor, and converting it to a Tensor evaluates the whole chain in one loop, without intermediate tensors, and
+// records a single ExpressionFunction for its gradient:
+//     Tensor output = (input * scale - shift) / 2.0f;
+// Tensors are held by pointer like in the gradient functions, so they must be named tensors which outlive the
+// result, and operands such as Tensor::ones(...) have to be stored in a variable first.
+// Every tensor is given the index of its position in the expression. The values and offsets passed to an expression
+// start at its first tensor, and nodes pass those of their right operand on after the tensors of their left one.
+
+// Offsets of an element which is at the same index in every tensor
+struct SameOffset {
+	int index;
+	int operator[](int) const { return index; }
+	SameOffset operator+(int) const { return *this; }
+};
+
+class TensorExpression {
+private:
+	Tensor* tensor;
+public:
+	static const int numTensors = 1;
+
+	explicit TensorExpression(Tensor& tensor) : tensor(&tensor) {}
+
+	void getTensors(Tensor** tensors) const { tensors[0] = tensor; }
+	void setTensors(Tensor* const* tensors) { tensor = tensors[0]; }
+
+	template<typename Offsets>
+	float evaluate(const float* const* values, Offsets offsets) const
+	{
+		return values[0][offsets[0]];
+	}
+
+	template<typename Offsets, typename GradientOffsets>
+	void backward(const float* const* values, Offsets offsets, float previous, float* const* gradients,
+		GradientOffsets gradientOffsets) const
+	{
+		gradients[0][gradientOffsets[0]] += previous;
+	}
+};
+
+class ScalarExpression {
+private:
+	float value;
+public:
+	static const int numTensors = 0;
+
+	explicit ScalarExpression(float value) : value(value) {}
+
+	void getTensors(Tensor** tensors) const {}
+	void setTensors(Tensor* const* tensors) {}
+
+	template<typename Offsets>
+	float evaluate(const float* const* values, Offsets offsets) const
+	{
+		return value;
+	}
+
+	template<typename Offsets, typename GradientOffsets>
+	void backward(const float* const* values, Offsets offsets, float previous, float* const* gradients,
+		GradientOffsets gradientOffsets) const
+	{
+	}
+};
+
+template<typename Operation, typename Left, typename Right>
+class BinaryExpression {
+private:
+	Left left;
+	Right right;
+	Operation operation;
+public:
+	static const int numTensors = Left::numTensors + Right::numTensors;
+
+	BinaryExpression(const Left& left, const Right& right) : left(left), right(right) {}
+
+	void getTensors(Tensor** tensors) const
+	{
+		left.getTensors(tensors);
+		right.getTensors(tensors + Left::numTensors);
+	}
+
+	void setTensors(Tensor* const* tensors)
+	{
+		left.setTensors(tensors);
+		right.setTensors(tensors + Left::numTensors);
+	}
+
+	template<typename Offsets>
+	float evaluate(const float* const* values, Offsets offsets) const
+	{
+		return operation(left.evaluate(values, offsets),
+			right.evaluate(values + Left::numTensors, offsets + Left::numTensors));
+	}
+
+	// Adds previous times the derivative of the expression with respect to each tensor to its gradient
+	template<typename Offsets, typename GradientOffsets>
+	void backward(const float* const* values, Offsets offsets, float previous, float* const* gradients,
+		GradientOffsets gradientOffsets) const
+	{
+		float x = left.evaluate(values, offsets);
+		float y = right.evaluate(values + Left::numTensors, offsets + Left::numTensors);
+		left.backward(values, offsets, previous * operation.derivative1(x, y), gradients, gradientOffsets);
+		right.backward(values + Left::numTensors, offsets + Left::numTensors, previous * operation.derivative2(x, y),
+			gradients + Left::numTensors, gradientOffsets + Left::numTensors);
+	}
+
+	operator Tensor() const;
+};
+
+// Gradient of a whole expression, summed back over the dimensions each tensor was broadcast along
+template<typename Expression>
+class ExpressionFunction : public GradientFunction {
+private:
+	Expression expression;
+public:
+	ExpressionFunction(const Expression& expression) : expression(expression)
+	{
+		//Inside a checkpointed layer the tensors are swapped for copies which outlive the layer, like makeGradientFunction does
+		Tensor* tensors[Expression::numTensors];
+		this->expression.getTensors(tensors);
+		for (Tensor*& tensor : tensors) tensor = keepDependent(tensor);
+		this->expression.setTensors(tensors);
+	}
+
+	gradientList calculateGradient(Tensor& previousGradient) const override
+	{
+		const int numTensors = Expression::numTensors;
+		Tensor* tensors[numTensors];
+		expression.getTensors(tensors);
+
+		std::vector<Tensor> gradients;
+		gradients.reserve(numTensors);
+		const float* values[numTensors];
+		float* gradientValues[numTensors];
+		std::vector<const Tensor*> operands{ &previousGradient };
+		int size = previousGradient.getSize();
+		bool sameShape = previousGradient.isContiguous();
+		for (int i = 0; i < numTensors; i++) {
+			const Tensor* tensor = tensors[i];
+			gradients.push_back(Tensor::zeroes(tensor->getShape()));
+			gradientValues[i] = gradients.back().getValues();
+			values[i] = tensor->getValues();
+			sameShape = sameShape && tensor->getSize() == size && tensor->isContiguous();
+			operands.push_back(tensor);
+		}
+		for (const Tensor& gradient : gradients) operands.push_back(&gradient);
+
+		const float* previousValues = static_cast<const Tensor&>(previousGradient).getValues();
+		if (sameShape) {
+			ThreadPool::parallelFor(size, [&](int begin, int end) {
+				for (int i = begin; i < end; i++)
+					expression.backward(values, SameOffset{ i }, previousValues[i], gradientValues, SameOffset{ i });
+			});
+		}
+		else {
+			//Broadcast tensors gather from many elements into one gradient value, so they are walked in order
+			BroadcastIterator iterator(previousGradient.getShape(), operands);
+			int offsets[numTensors], gradientOffsets[numTensors];
+			for (int i = 0; i < size; i++, iterator.next()) {
+				for (int j = 0; j < numTensors; j++) {
+					offsets[j] = iterator.getOffset(1 + j);
+					gradientOffsets[j] = iterator.getOffset(1 + numTensors + j);
+				}
+				expression.backward(values, offsets, previousValues[iterator.getOffset(0)], gradientValues,
+					gradientOffsets);
+			}
+		}
+
+		gradientList list;
+		for (int i = 0; i < numTensors; i++) list.push_back(gradientTuple(tensors[i], gradients[i]));
+		return list;
+	}
+
+	std::vector<Tensor*> getDependents() const override
+	{
+		Tensor* tensors[Expression::numTensors];
+		expression.getTensors(tensors);
+		return std::vector<Tensor*>(tensors, tensors + Expression::numTensors);
+	}
+
+	std::vector<const Tensor*> getSavedTensors() const override
+	{
+		Tensor* tensors[Expression::numTensors];
+		expression.getTensors(tensors);
+		return std::vector<const Tensor*>(tensors, tensors + Expression::numTensors);
+	}
+};
+
+// Evaluates every element of an expression in one pass over its tensors
+template<typename Expression>
+Tensor evaluate(const Expression& expression)
+{
+	const int numTensors = Expression::numTensors;
+	Tensor* tensors[numTensors];
+	expression.getTensors(tensors);
+
+	std::vector<int> shape = tensors[0]->getShape();
+	for (int i = 1; i < numTensors; i++) shape = BroadcastPlan::get(shape, tensors[i]->getShape())->shape;
+	Tensor newTensor = Tensor::empty(shape);
+	float* newValues = newTensor.getValues();
+	int size = newTensor.getSize();
+
+	const float* values[numTensors];
+	std::vector<const Tensor*> operands;
+	bool sameShape = true, requiresGrad = false;
+	for (int i = 0; i < numTensors; i++) {
+		const Tensor* tensor = tensors[i];
+		values[i] = tensor->getValues();
+		sameShape = sameShape && tensor->getSize() == size && tensor->isContiguous();
+		requiresGrad = requiresGrad || tensor->requiresGradient();
+		operands.push_back(tensor);
+	}
+
+	ThreadPool::parallelFor(size, [&](int begin, int end) {
+		if (sameShape) {
+			for (int i = begin; i < end; i++) newValues[i] = expression.evaluate(values, SameOffset{ i });
+			return;
+		}
+		BroadcastIterator iterator(shape, operands);
+		iterator.seek(begin);
+		int offsets[numTensors];
+		for (int i = begin; i < end; i++, iterator.next()) {
+			for (int j = 0; j < numTensors; j++) offsets[j] = iterator.getOffset(j);
+			newValues[i] = expression.evaluate(values, offsets);
+		}
+	});
+
+	if (requiresGrad) {
+		newTensor.requiresGrad = true;
+		newTensor.function = makeGradientFunction<ExpressionFunction<Expression>>(expression);
+	}
+	return newTensor;
+}
+
+template<typename Operation, typename Left, typename Right>
+BinaryExpression<Operation, Left, Right>::operator Tensor() const
+{
+	return ::evaluate(*this);
+}
+
+inline TensorExpression toExpression(Tensor& tensor) { return TensorExpression(tensor); }
+inline ScalarExpression toExpression(float value) { return ScalarExpression(value); }
+template<typename Operation, typename Left, typename Right>
+const BinaryExpression<Operation, Left, Right>& toExpression(const BinaryExpression<Operation, Left, Right>& expression)
+{
+	return expression;
+}
+
+template<typename T> struct IsExpression : std::false_type {};
+template<typename Operation, typename Left, typename Right>
+struct IsExpression<BinaryExpression<Operation, Left, Right>> : std::true_type {};
+
+// Expressions, and tensors which are not temporaries or const, can be operands which fuse
+template<typename T>
+struct IsFusedOperand : std::integral_constant<bool, IsExpression<typename std::decay<T>::type>::value ||
+	std::is_same<T, Tensor&>::value> {};
+
+template<typename Left, typename Right>
+struct IsFusable : std::integral_constant<bool,
+	(IsFusedOperand<Left>::value && (IsFusedOperand<Right>::value || std::is_arithmetic<typename std::decay<Right>::type>::value)) ||
+	(std::is_arithmetic<typename std::decay<Left>::type>::value && IsFusedOperand<Right>::value)> {};
+
+template<typename T>
+using ExpressionOf = typename std::decay<decltype(toExpression(std::declval<T>()))>::type;
+
+template<typename Operation, typename Left, typename Right>
+using FusedExpression = typename std::enable_if<IsFusable<Left, Right>::value,
+	BinaryExpression<Operation, ExpressionOf<Left>, ExpressionOf<Right>>>::type;
+
+template<typename Left, typename Right>
+FusedExpression<AddOperation, Left, Right> operator+(Left&& left, Right&& right)
+{
+	return { toExpression(left), toExpression(right) };
+}
+
+template<typename Left, typename Right>
+FusedExpression<SubtractOperation, Left, Right> operator-(Left&& left, Right&& right)
+{
+	return { toExpression(left), toExpression(right) };
+}
+
+template<typename Left, typename Right>
+FusedExpression<MultiplyOperation, Left, Right> operator*(Left&& left, Right&& right)
+{
+	return { toExpression(left), toExpression(right) };
+}
+
+template<typename Left, typename Right>
+FusedExpression<DivideOperation, Left, Right> operator/(Left&& left, Right&& right)
+{
+	return { toExpression(left), toExpression(right) };
+}
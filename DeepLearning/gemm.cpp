@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "gemm.h"
+#include "simd.h"
+#include "allocator.h"
+#include "thread_pool.h"
+
+namespace {
+	//Tile of the loop used at SimdLevel::Scalar
+	const int scalarTileRows = 6;
+	const int scalarTileColumns = 16;
+
+	//Depth of the packed blocks, and the rows of a and columns of b in each. Every tile size divides them, and at
+	//most a strip of b is 32KB, a block of a is 120KB and a panel of b is 4MB.
+	const int blockDepth = 256;
+	const int blockRows = 120;
+	const int blockColumns = 4096;
+
+	//Packing buffer of one thread, aligned for the kernels
+	class PackBuffer {
+	private:
+		float* values = nullptr;
+		size_t size = 0;
+	public:
+		~PackBuffer() { alignedFree(values); }
+
+		float* get(size_t size)
+		{
+			if (size > this->size) {
+				alignedFree(values);
+				values = static_cast<float*>(alignedAllocate(size * sizeof(float)));
+				this->size = size;
+			}
+			return values;
+		}
+	};
+
+	//Operand read through the distance between its rows and between its columns, one of which is its leading dimension
+	//and the other 1 depending on whether it is transposed
+	struct Matrix {
+		const float* values;
+		int rowStep;
+		int columnStep;
+
+		Matrix(const float* values, int leadingDimension, bool transposed) : values(values),
+			rowStep(transposed ? 1 : leadingDimension), columnStep(transposed ? leadingDimension : 1) {}
+
+		float get(int row, int column) const { return values[(long long)row * rowStep + (long long)column * columnStep]; }
+		Matrix offset(int row, int column) const
+		{
+			Matrix matrix(*this);
+			matrix.values += (long long)row * rowStep + (long long)column * columnStep;
+			return matrix;
+		}
+	};
+
+	//Copies a block of a into strips of tileRows rows, stored column by column. Rows past the end are zero.
+	void packA(const Matrix& a, int rows, int depth, int tileRows, float* packed)
+	{
+		for (int strip = 0; strip < rows; strip += tileRows) {
+			int stripRows = std::min(tileRows, rows - strip);
+			for (int p = 0; p < depth; p++) {
+				for (int i = 0; i < stripRows; i++) packed[i] = a.get(strip + i, p);
+				for (int i = stripRows; i < tileRows; i++) packed[i] = 0.0f;
+				packed += tileRows;
+			}
+		}
+	}
+
+	//Copies a block of b into strips of tileColumns columns, stored row by row. Columns past the end are zero.
+	void packB(const Matrix& b, int depth, int columns, int tileColumns, float* packed)
+	{
+		for (int strip = 0; strip < columns; strip += tileColumns) {
+			int stripColumns = std::min(tileColumns, columns - strip);
+			for (int p = 0; p < depth; p++) {
+				for (int j = 0; j < stripColumns; j++) packed[j] = b.get(p, strip + j);
+				for (int j = stripColumns; j < tileColumns; j++) packed[j] = 0.0f;
+				packed += tileColumns;
+			}
+		}
+	}
+
+	//Multiplies a strip of a by a strip of b, and writes or adds the rows and columns of the tile which are in out
+	void multiplyTile(int depth, const float* packedA, const float* packedB, float* out, int ldOut, int rows,
+		int columns, bool accumulate)
+	{
+		float tile[scalarTileRows][scalarTileColumns] = {};
+		for (int p = 0; p < depth; p++) {
+			const float* aColumn = packedA + p * scalarTileRows;
+			const float* bRow = packedB + p * scalarTileColumns;
+			for (int i = 0; i < scalarTileRows; i++) {
+				for (int j = 0; j < scalarTileColumns; j++) tile[i][j] += aColumn[i] * bRow[j];
+			}
+		}
+		for (int i = 0; i < rows; i++) {
+			float* outRow = out + i * ldOut;
+			if (accumulate) for (int j = 0; j < columns; j++) outRow[j] += tile[i][j];
+			else for (int j = 0; j < columns; j++) outRow[j] = tile[i][j];
+		}
+	}
+
+	int roundUp(int value, int multiple)
+	{
+		return (value + multiple - 1) / multiple * multiple;
+	}
+
+	GemmKernel selectKernel()
+	{
+		GemmKernel kernel = getGemmKernel();
+		if (!kernel.multiplyTile) kernel = GemmKernel{ scalarTileRows, scalarTileColumns, &multiplyTile };
+		return kernel;
+	}
+
+	//Packs the columns of b from columnBegin to columnEnd in the layout of a PackedMatrix. The block at depth starts at
+	//depth * paddedColumns, and the strips from columnBegin on are packed one after another from there.
+	void packPanels(const Matrix& b, int k, int columnBegin, int columnEnd, int tileColumns, int paddedColumns,
+		float* values)
+	{
+		for (int depth = 0; depth < k; depth += blockDepth) {
+			int depthSize = std::min(blockDepth, k - depth);
+			packB(b.offset(depth, columnBegin), depthSize, columnEnd - columnBegin, tileColumns,
+				values + (size_t)depth * paddedColumns + (size_t)columnBegin * depthSize);
+		}
+	}
+
+	//Packs each panel of b when it is needed, into a buffer of the calling thread
+	struct PackingPanels {
+		Matrix b;
+		int tileColumns;
+
+		const float* operator()(int depth, int column, int depthSize, int columns) const
+		{
+			thread_local PackBuffer buffer;
+			float* packed = buffer.get((size_t)roundUp(columns, tileColumns) * depthSize);
+			packB(b.offset(depth, column), depthSize, columns, tileColumns, packed);
+			return packed;
+		}
+	};
+
+	//Reads the panels of b from a PackedMatrix, from its column firstColumn on
+	struct PackedPanels {
+		const float* values;
+		int paddedColumns;
+		int firstColumn;
+
+		const float* operator()(int depth, int column, int depthSize, int) const
+		{
+			return values + (size_t)depth * paddedColumns + (size_t)(firstColumn + column) * depthSize;
+		}
+	};
+
+	//Multiplies on the calling thread, with the panels of b given by getPanel and the blocks of a packed into its own buffer
+	template<typename Panels>
+	void multiplyBlocks(const GemmKernel& kernel, int m, int n, int k, const Matrix& a, const Panels& getPanel,
+		float* out, int ldOut, bool accumulate)
+	{
+		int tileRows = kernel.tileRows, tileColumns = kernel.tileColumns;
+		thread_local PackBuffer bufferA;
+		float* packedA = bufferA.get((size_t)std::min(blockRows, m + tileRows - 1) * blockDepth);
+		for (int column = 0; column < n; column += blockColumns) {
+			int columns = std::min(blockColumns, n - column);
+			for (int depth = 0; depth < k; depth += blockDepth) {
+				int depthSize = std::min(blockDepth, k - depth);
+				const float* packedB = getPanel(depth, column, depthSize, columns);
+				//Unless out is accumulated into, the first block along the depth writes it and the rest add to it
+				bool accumulateBlock = accumulate || depth > 0;
+				for (int row = 0; row < m; row += blockRows) {
+					int rows = std::min(blockRows, m - row);
+					packA(a.offset(row, depth), rows, depthSize, tileRows, packedA);
+					for (int j = 0; j < columns; j += tileColumns) {
+						const float* stripB = packedB + j * depthSize;
+						for (int i = 0; i < rows; i += tileRows) {
+							kernel.multiplyTile(depthSize, packedA + i * depthSize, stripB,
+								out + (row + i) * ldOut + column + j, ldOut, std::min(tileRows, rows - i),
+								std::min(tileColumns, columns - j), accumulateBlock);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//Multiplies by b, or by panels which are already packed in the layout of a PackedMatrix when b is null. Large
+	//products are split into a grid of whole strips of out, with parts close to square so that each thread packs as
+	//little as it can.
+	void multiply(const GemmKernel& kernel, int m, int n, int k, const Matrix& a, const Matrix* b, const float* panels,
+		float* out, int ldOut, bool accumulate)
+	{
+		if (m == 0 || n == 0) return;
+		if (k == 0) {
+			if (accumulate) return;
+			for (int i = 0; i < m; i++) std::fill(out + i * ldOut, out + i * ldOut + n, 0.0f);
+			return;
+		}
+
+		int rowStrips = (m + kernel.tileRows - 1) / kernel.tileRows;
+		int columnStrips = (n + kernel.tileColumns - 1) / kernel.tileColumns;
+		int paddedColumns = columnStrips * kernel.tileColumns;
+		long long work = (long long)m * n * k;
+		int numChunks = std::min(ThreadPool::getNumChunks((int)std::min<long long>(work, INT_MAX)), rowStrips * columnStrips);
+		if (numChunks <= 1) {
+			if (panels) multiplyBlocks(kernel, m, n, k, a, PackedPanels{ panels, paddedColumns, 0 }, out, ldOut, accumulate);
+			else multiplyBlocks(kernel, m, n, k, a, PackingPanels{ *b, kernel.tileColumns }, out, ldOut, accumulate);
+			return;
+		}
+
+		int rowParts = (int)std::lround(std::sqrt((double)numChunks * m / n));
+		rowParts = std::max(1, std::min({ rowParts, rowStrips, numChunks }));
+		int columnParts = std::max(1, std::min(columnStrips, numChunks / rowParts));
+		auto getColumnBegin = [&](int columnPart) {
+			return std::min(n, (int)((long long)columnStrips * columnPart / columnParts) * kernel.tileColumns);
+		};
+
+		//The row parts of a column all read the same panels of b, so each column part packs them once for all of them
+		PackBuffer sharedPanels;
+		if (!panels && rowParts > 1) {
+			float* values = sharedPanels.get((size_t)k * paddedColumns);
+			ThreadPool::run(columnParts, [&](int columnPart) {
+				packPanels(*b, k, getColumnBegin(columnPart), getColumnBegin(columnPart + 1), kernel.tileColumns,
+					paddedColumns, values);
+			});
+			panels = values;
+		}
+
+		ThreadPool::run(rowParts * columnParts, [&](int chunk) {
+			int rowPart = chunk / columnParts, columnPart = chunk % columnParts;
+			int rowBegin = (int)((long long)rowStrips * rowPart / rowParts) * kernel.tileRows;
+			int rowEnd = std::min(m, (int)((long long)rowStrips * (rowPart + 1) / rowParts) * kernel.tileRows);
+			int columnBegin = getColumnBegin(columnPart), columnEnd = getColumnBegin(columnPart + 1);
+			if (panels) {
+				multiplyBlocks(kernel, rowEnd - rowBegin, columnEnd - columnBegin, k, a.offset(rowBegin, 0),
+					PackedPanels{ panels, paddedColumns, columnBegin }, out + rowBegin * ldOut + columnBegin, ldOut,
+					accumulate);
+			}
+			else {
+				multiplyBlocks(kernel, rowEnd - rowBegin, columnEnd - columnBegin, k, a.offset(rowBegin, 0),
+					PackingPanels{ b->offset(0, columnBegin), kernel.tileColumns }, out + rowBegin * ldOut + columnBegin,
+					ldOut, accumulate);
+			}
+		});
+	}
+}
+
+void gemm(bool transA, bool transB, int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* out,
+	int ldOut, bool accumulate)
+{
+	Matrix matrixB(b, ldb, transB);
+	multiply(selectKernel(), m, n, k, Matrix(a, lda, transA), &matrixB, nullptr, out, ldOut, accumulate);
+}
+
+void gemm(bool transA, int m, const float* a, int lda, const PackedMatrix& b, float* out, int ldOut, bool accumulate)
+{
+	multiply(b.kernel, m, b.columns, b.depth, Matrix(a, lda, transA), nullptr, b.values, out, ldOut, accumulate);
+}
+
+PackedMatrix::PackedMatrix() : values(nullptr), depth(0), columns(0), paddedColumns(0), kernel{}
+{
+}
+
+PackedMatrix::~PackedMatrix()
+{
+	alignedFree(values);
+}
+
+void PackedMatrix::pack(bool transB, int k, int n, const float* b, int ldb)
+{
+	kernel = selectKernel();
+	depth = k;
+	columns = n;
+	paddedColumns = roundUp(n, kernel.tileColumns);
+	alignedFree(values);
+	values = nullptr;
+	if (k == 0 || n == 0) return;
+	values = static_cast<float*>(alignedAllocate((size_t)k * paddedColumns * sizeof(float)));
+
+	//Every block along the depth holds the strips of all columns, so the panel of any whole strip can be found
+	packPanels(Matrix(b, ldb, transB), k, 0, n, kernel.tileColumns, paddedColumns, values);
+}
+
+int PackedMatrix::getDepth() const
+{
+	return depth;
+}
+
+int PackedMatrix::getColumns() const
+{
+	return columns;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "simd.h"
+
+class PackedMatrix;
+
+// Row-major matrix multiplication out = op(a) * op(b), where op(a) is m x k, op(b) is k x n and each matrix is read
+// through its leading dimension. transA and transB read a and b as their transposes, which are stored k x m and
+// n x k, and accumulate adds the product to out instead of overwriting it. The loops are blocked so that a panel of
+// b stays in L3, a block of a in L2 and a strip of the panel in L1, while each small tile of out is summed in
+// registers. Both blocks are packed into the order in which the tiles read them, so every inner loop walks
+// contiguous memory whichever way the operands are stored.
+// Large products are split across the ThreadPool as a grid of blocks of out, each multiplied like this on one thread.
+void gemm(bool transA, bool transB, int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* out,
+	int ldOut, bool accumulate = false);
+
+// Like gemm, with op(b) read from a PackedMatrix instead of being packed on every call
+void gemm(bool transA, int m, const float* a, int lda, const PackedMatrix& b, float* out, int ldOut,
+	bool accumulate = false);
+
+// Matrix b of gemm stored once in the panels which the kernel reads, for products which reuse the same b many times.
+// The panels are laid out for the kernel selected when the matrix is packed, and products with it always use that
+// kernel, so they stay valid if the SimdLevel changes.
+class PackedMatrix {
+private:
+	float* values;
+	int depth;
+	int columns;
+	int paddedColumns;
+	GemmKernel kernel;
+
+	friend void gemm(bool transA, int m, const float* a, int lda, const PackedMatrix& b, float* out, int ldOut,
+		bool accumulate);
+public:
+	PackedMatrix();
+	~PackedMatrix();
+
+	PackedMatrix(const PackedMatrix&) = delete;
+	PackedMatrix& operator=(const PackedMatrix&) = delete;
+
+	// Packs op(b), which is k x n, replacing anything packed before
+	void pack(bool transB, int k, int n, const float* b, int ldb);
+	int getDepth() const;
+	int getColumns() const;
+};
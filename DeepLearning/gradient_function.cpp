@@ -1,5 +1,211 @@
+#include <stdexcept>
+#include <algorithm>
+#include <climits>
+
 #include "gradient_function.h"
 #include "deep_learning.h"
+#include "broadcast_iterator.h"
+#include "broadcast_plan.h"
+#include "gemm.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace {
+	template<typename T>
+	size_t getVectorBytes(const std::vector<T>& values)
+	{
+		return values.capacity() * sizeof(T);
+	}
+
+	//Reads values without materializing constants, which are then read through their strides of 0
+	const float* readValues(const Tensor& tensor)
+	{
+		return tensor.getValues();
+	}
+
+	//Runs body(begin, end, gradientValues) over chunks of [0, size), with the values of each gradient in the order given.
+	//Gradients smaller than size are broadcast, so different chunks can add to the same value. Every chunk after the
+	//first adds to its own zeroed copy of those gradients instead, and the copies are summed once all chunks are done.
+	template<typename Body>
+	void accumulateInParallel(int size, const std::vector<Tensor*>& gradients, Body body)
+	{
+		std::vector<float*> values;
+		for (Tensor* gradient : gradients) values.push_back(gradient->getValues());
+		int numChunks = std::min(ThreadPool::getNumChunks(size), size);
+		if (numChunks <= 1) {
+			body(0, size, values.data());
+			return;
+		}
+
+		int numGradients = gradients.size();
+		std::vector<std::vector<float>> copies(numChunks * numGradients);
+		ThreadPool::run(numChunks, [&](int chunk) {
+			std::vector<float>* chunkCopies = &copies[chunk * numGradients];
+			std::vector<float*> chunkValues(values);
+			for (int i = 0; i < numGradients; i++) {
+				if (chunk == 0 || gradients[i]->getSize() == size) continue;
+				chunkCopies[i].assign(gradients[i]->getSize(), 0.0f);
+				chunkValues[i] = chunkCopies[i].data();
+			}
+			int begin = (long long)size * chunk / numChunks;
+			int end = (long long)size * (chunk + 1) / numChunks;
+			body(begin, end, chunkValues.data());
+		});
+
+		for (int i = 0; i < numGradients; i++) {
+			if (gradients[i]->getSize() == size) continue;
+			ThreadPool::parallelFor(gradients[i]->getSize(), [&](int begin, int end) {
+				for (int chunk = 1; chunk < numChunks; chunk++) {
+					const float* copy = copies[chunk * numGradients + i].data();
+					for (int j = begin; j < end; j++) values[i][j] += copy[j];
+				}
+			}, numChunks);
+		}
+	}
+
+	//Four running sums, so that the additions do not all wait on each other
+	float sumValues(const float* values, int size)
+	{
+		float sums[4] = { 0, 0, 0, 0 };
+		int i = 0;
+		for (; i + 4 <= size; i += 4) {
+			for (int j = 0; j < 4; j++) sums[j] += values[i + j];
+		}
+		for (; i < size; i++) sums[0] += values[i];
+		return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	}
+
+	//Adds scale times values, laid out contiguously in the broadcast shape of a plan, to the gradient of an operand
+	//after summing them over the axes it was broadcast along. Runs of dimensions which are all reduced or all kept are
+	//merged, and the values are walked as rows of the innermost run, so each row is either summed into one gradient
+	//value or added to a contiguous stretch of the gradient.
+	void reduceGradient(const float* values, const BroadcastPlan& plan, int operand, float scale, float* gradientValues)
+	{
+		const std::vector<int>& shape = plan.shape;
+		const std::vector<int>& reducedAxes = plan.reducedAxes[operand];
+		int size = plan.size;
+		if (reducedAxes.empty()) {
+			ThreadPool::parallelFor(size, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) gradientValues[i] += scale * values[i];
+			});
+			return;
+		}
+
+		//Built from the last dimension, where the gradient stride of a kept run is the size of the kept runs after it
+		std::vector<int> runShape, runStrides;
+		std::vector<bool> runReduced;
+		int gradientSize = 1;
+		for (int dim = shape.size() - 1; dim >= 0; dim--) {
+			if (shape[dim] == 1) continue;
+			bool reduced = std::find(reducedAxes.begin(), reducedAxes.end(), dim) != reducedAxes.end();
+			if (!runShape.empty() && runReduced.front() == reduced) {
+				runShape.front() *= shape[dim];
+			}
+			else {
+				runShape.insert(runShape.begin(), shape[dim]);
+				runStrides.insert(runStrides.begin(), reduced ? 0 : gradientSize);
+				runReduced.insert(runReduced.begin(), reduced);
+			}
+			if (!reduced) gradientSize *= shape[dim];
+		}
+		//Every dimension has size 1, so the one value is added straight across
+		if (runShape.empty()) {
+			*gradientValues += scale * *values;
+			return;
+		}
+		int rowSize = runShape.back();
+		bool rowReduced = runReduced.back();
+		runShape.pop_back();
+		runStrides.pop_back();
+		runReduced.pop_back();
+		int numRows = size / rowSize;
+
+		auto addRows = [&](int begin, int end, float* rowGradients) {
+			BroadcastIterator iterator(runShape, { runShape }, { runStrides });
+			iterator.seek(begin);
+			for (int row = begin; row < end; row++, iterator.next()) {
+				const float* rowValues = values + (long long)row * rowSize;
+				float* rowGradient = rowGradients + iterator.getOffset(0);
+				if (rowReduced) *rowGradient += scale * sumValues(rowValues, rowSize);
+				else for (int i = 0; i < rowSize; i++) rowGradient[i] += scale * rowValues[i];
+			}
+		};
+
+		//Without a reduced run outside the rows, every row adds to different gradient values
+		if (std::find(runReduced.begin(), runReduced.end(), true) == runReduced.end()) {
+			ThreadPool::parallelFor(numRows, [&](int begin, int end) { addRows(begin, end, gradientValues); }, rowSize);
+			return;
+		}
+		int numChunks = std::min(ThreadPool::getNumChunks(size), numRows);
+		if (numChunks <= 1) {
+			addRows(0, numRows, gradientValues);
+			return;
+		}
+		//Chunks after the first sum into their own zeroed copies, which are added once all chunks are done
+		std::vector<std::vector<float>> copies(numChunks);
+		ThreadPool::run(numChunks, [&](int chunk) {
+			float* chunkGradients = gradientValues;
+			if (chunk > 0) {
+				copies[chunk].assign(gradientSize, 0.0f);
+				chunkGradients = copies[chunk].data();
+			}
+			int begin = (long long)numRows * chunk / numChunks;
+			int end = (long long)numRows * (chunk + 1) / numChunks;
+			addRows(begin, end, chunkGradients);
+		});
+		ThreadPool::parallelFor(gradientSize, [&](int begin, int end) {
+			for (int chunk = 1; chunk < numChunks; chunk++) {
+				const float* copy = copies[chunk].data();
+				for (int i = begin; i < end; i++) gradientValues[i] += copy[i];
+			}
+		}, numChunks);
+	}
+}
+
+GradientFunction::~GradientFunction()
+{
+	if (trackedBytes) MemoryStats::deallocate(MemoryCategory::Saved, trackedBytes);
+}
+
+size_t GradientFunction::getSavedBytes() const
+{
+	return 0;
+}
+
+std::vector<const Tensor*> GradientFunction::getSavedTensors() const
+{
+	return {};
+}
+
+void GradientFunction::trackMemory(size_t objectBytes)
+{
+	trackedBytes = objectBytes + getSavedBytes();
+	MemoryStats::allocate(MemoryCategory::Saved, trackedBytes);
+}
+
+void GradientFunction::saveVersions()
+{
+	savedVersions.clear();
+	for (const Tensor* saved : getSavedTensors()) savedVersions.push_back(saved->getVersion());
+}
+
+void GradientFunction::checkVersions() const
+{
+	std::vector<const Tensor*> savedTensors = getSavedTensors();
+	for (int i = 0; i < savedTensors.size(); i++) {
+		if (savedTensors[i]->getVersion() != savedVersions[i])
+			throw std::runtime_error("A tensor needed to calculate the gradient has been modified by an in-place operation.");
+	}
+}
+
+gradientList ReleasedFunction::calculateGradient(Tensor&) const
+{
+	throw std::logic_error("The graph has already been freed by backwards. Pass retainGraph to backpropagate through it again.");
+}
+
+std::vector<Tensor*> ReleasedFunction::getDependents() const {
+	return {};
+}
 
 GetFunction::GetFunction(Tensor* original, int index, int size) : original(original), index(index), size(size)
 {
@@ -9,7 +215,8 @@ GetFunction::GetFunction(Tensor* original, int index, int size) : original(origi
 gradientList GetFunction::calculateGradient(Tensor& previousGradient) const {
 	int gradientSize = original->getSize();
 	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
+	Tensor gradient = Tensor::empty(gradientShape);
+	float* gradientValues = gradient.getValues();
 	for (int i = 0; i < gradientSize; i++) {
 		if (i - index >= 0 && i - index < size) {
 			gradientValues[i] = previousGradient.at(i - index);
@@ -18,7 +225,7 @@ gradientList GetFunction::calculateGradient(Tensor& previousGradient) const {
 			gradientValues[i] = 0.0f;
 		}
 	}
-	return gradientList{ gradientTuple(original, Tensor::fromValues(gradientValues, gradientShape)) };
+	return gradientList{ gradientTuple(original, gradient) };
 }
 
 std::vector<Tensor*> GetFunction::getDependents() const {
@@ -34,7 +241,8 @@ SetSingleFunction::SetSingleFunction(Tensor* original, int index, int size) : or
 gradientList SetSingleFunction::calculateGradient(Tensor& previousGradient) const {
 	int gradientSize = original->getSize();
 	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
+	Tensor gradient = Tensor::empty(gradientShape);
+	float* gradientValues = gradient.getValues();
 	for (int i = 0; i < gradientSize; i++) {
 		if (i - index >= 0 && i - index < size) {
 			gradientValues[i] = 0.0f;
@@ -43,7 +251,7 @@ gradientList SetSingleFunction::calculateGradient(Tensor& previousGradient) cons
 			gradientValues[i] = previousGradient.at(i);
 		}
 	}
-	return gradientList{ gradientTuple(original, Tensor::fromValues(gradientValues, gradientShape)) };
+	return gradientList{ gradientTuple(original, gradient) };
 }
 
 std::vector<Tensor*> SetSingleFunction::getDependents() const {
@@ -51,9 +259,8 @@ std::vector<Tensor*> SetSingleFunction::getDependents() const {
 }
 
 
-SetTensorFunction::SetTensorFunction(Tensor* copyTo, Tensor* copyFrom, int index, int size, const std::vector<int>& broadcastShape,
-	const std::vector<int>& broadcastedIndices) : copyTo(copyTo), copyFrom(copyFrom), index(index), size(size),
-	broadcastShape(broadcastShape), broadcastedIndices(broadcastedIndices)
+SetTensorFunction::SetTensorFunction(Tensor* copyTo, Tensor* copyFrom, int index, int size, const std::vector<int>& broadcastShape) :
+	copyTo(copyTo), copyFrom(copyFrom), index(index), size(size), broadcastShape(broadcastShape)
 {
 
 }
@@ -66,7 +273,8 @@ gradientList SetTensorFunction::calculateGradient(Tensor& previousGradient) cons
 	{
 		int gradientSize = copyTo->getSize();
 		const std::vector<int>& gradientShape = copyTo->getShape();
-		float* gradientValues = new float[gradientSize];
+		Tensor gradient = Tensor::empty(gradientShape);
+		float* gradientValues = gradient.getValues();
 		for (int i = 0; i < gradientSize; i++) {
 			if (i - index >= 0 && i - index < size) {
 				gradientValues[i] = 0.0f;
@@ -75,23 +283,18 @@ gradientList SetTensorFunction::calculateGradient(Tensor& previousGradient) cons
 				gradientValues[i] = previousGradient.at(i);
 			}
 		}
-		list.push_back(gradientTuple{ copyTo, Tensor::fromValues(gradientValues, gradientShape) });
+		list.push_back(gradientTuple{ copyTo, gradient });
 	}
 
 	//Copy-From gradient
 	{
-		int gradientSize = copyFrom->getSize();
-		const std::vector<int>& gradientShape = copyFrom->getShape();
-		float* gradientValues = new float[gradientSize];
-		for (int i = 0; i < gradientSize; i++) {
-			gradientValues[i] = 0.0f;
+		Tensor gradient = Tensor::zeroes(copyFrom->getShape());
+		float* gradientValues = gradient.getValues();
+		BroadcastIterator iterator(broadcastShape, { &gradient });
+		for (int i = 0; i < size; i++, iterator.next()) {
+			gradientValues[iterator.getOffset(0)] += previousGradient.at(index + i);
 		}
-		for (int i = 0; i < size; i++) {
-			int j = broadcastedIndices[i];
-			int k = index + i;
-			gradientValues[broadcastedIndices[i]] += previousGradient.at(index + i);
-		}
-		list.push_back(gradientTuple{ copyTo, Tensor::fromValues(gradientValues, gradientShape) });
+		list.push_back(gradientTuple{ copyFrom, gradient });
 	}
 	return list;
 }
@@ -100,248 +303,158 @@ std::vector<Tensor*> SetTensorFunction::getDependents() const {
 	return { copyTo, copyFrom};
 }
 
-AddSingleFunction::AddSingleFunction(Tensor* original) : original(original)
-{
-
+size_t SetTensorFunction::getSavedBytes() const {
+	return getVectorBytes(broadcastShape);
 }
-
-gradientList AddSingleFunction::calculateGradient(Tensor& previousGradient) const
+template<typename Operation>
+ElementwiseSingleFunction<Operation>::ElementwiseSingleFunction(Tensor* original, float value, Operation operation) :
+	original(original), value(value), operation(operation)
 {
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = previousGradient.at(i);
-	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
 }
 
-std::vector<Tensor*> AddSingleFunction::getDependents() const {
-	return { original };
-}
-
-AddTensorFunction::AddTensorFunction(Tensor* original1, Tensor* original2, const std::vector<int>& broadcastedIndices1,
-	const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
-{
-
-}
-
-gradientList AddTensorFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		gradientValues1[broadcastedIndices1[i]] += previousGradient.at(i);
-		gradientValues2[broadcastedIndices2[i]] += previousGradient.at(i);
-	}
-
-	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
-	};
-}
-
-std::vector<Tensor*> AddTensorFunction::getDependents() const {
-	return { original1, original2 };
-}
-
-
-
-SubtractSingleFunction::SubtractSingleFunction(Tensor* original) : original(original)
+template<typename Operation>
+gradientList ElementwiseSingleFunction<Operation>::calculateGradient(Tensor& previousGradient) const
 {
+	Tensor gradient = Tensor::empty(original->getShape());
+	float* gradientValues = gradient.getValues();
+	const float* previousValues = readValues(previousGradient);
+	const float* originalValues = readValues(*original);
 
+	backwardKernel kernel = getSimdKernels<Operation>().backward;
+	bool contiguous = previousGradient.isContiguous() && original->isContiguous();
+	ThreadPool::parallelFor(gradient.getSize(), [&](int begin, int end) {
+		if (contiguous && kernel) {
+			kernel(previousValues + begin, originalValues + begin, 1, &value, 0, gradientValues + begin, nullptr, end - begin);
+		}
+		else if (contiguous) {
+			for (int i = begin; i < end; i++) {
+				gradientValues[i] = previousValues[i] * operation.derivative1(originalValues[i], value);
+			}
+		}
+		else {
+			BroadcastIterator iterator(gradient.getShape(), { &previousGradient, original });
+			iterator.seek(begin);
+			for (int i = begin; i < end; i++, iterator.next()) {
+				gradientValues[i] = previousValues[iterator.getOffset(0)] * operation.derivative1(originalValues[iterator.getOffset(1)], value);
+			}
+		}
+	});
+	return gradientList{ gradientTuple(original, gradient) };
 }
 
-gradientList SubtractSingleFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = previousGradient.at(i);
-	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
-}
-
-
-std::vector<Tensor*> SubtractSingleFunction::getDependents() const {
+template<typename Operation>
+std::vector<Tensor*> ElementwiseSingleFunction<Operation>::getDependents() const {
 	return { original };
 }
 
-SubtractTensorFunction::SubtractTensorFunction(Tensor* original1, Tensor* original2, const std::vector<int>& broadcastedIndices1,
-	const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
-{
-
+template<typename Operation>
+std::vector<const Tensor*> ElementwiseSingleFunction<Operation>::getSavedTensors() const {
+	if (Operation::savesInputWithConstant) return { original };
+	return {};
 }
 
-gradientList SubtractTensorFunction::calculateGradient(Tensor& previousGradient) const
+template<typename Operation>
+ElementwiseFunction<Operation>::ElementwiseFunction(Tensor* original1, Tensor* original2, Operation operation) :
+	original1(original1), original2(original2), operation(operation)
 {
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		gradientValues1[broadcastedIndices1[i]] += previousGradient.at(i);
-		gradientValues2[broadcastedIndices2[i]] -= previousGradient.at(i);
-	}
-
-	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
-	};
-}
-
-std::vector<Tensor*> SubtractTensorFunction::getDependents() const {
-	return { original1, original2 };
 }
 
-
-
-MultiplySingleFunction::MultiplySingleFunction(Tensor* original, float value) : original(original), value(value)
+template<typename Operation>
+gradientList ElementwiseFunction<Operation>::calculateGradient(Tensor& previousGradient) const
 {
+	Tensor gradient1 = Tensor::zeroes(original1->getShape());
+	Tensor gradient2 = Tensor::zeroes(original2->getShape());
+	float* gradientValues1 = gradient1.getValues();
+	float* gradientValues2 = gradient2.getValues();
+	const float* previousValues = readValues(previousGradient);
+	const float* values1 = readValues(*original1);
+	const float* values2 = readValues(*original2);
+	int size = previousGradient.getSize();
 
-}
-
-gradientList MultiplySingleFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = previousGradient.at(i) * value;
+	//Without broadcasting every tensor is read in order, so no offsets are needed
+	bool sameShape = original1->getSize() == size && original2->getSize() == size && previousGradient.isContiguous() &&
+		original1->isContiguous() && original2->isContiguous();
+	backwardKernel kernel = getSimdKernels<Operation>().backward;
+	if (sameShape) {
+		ThreadPool::parallelFor(size, [&](int begin, int end) {
+			if (kernel) {
+				kernel(previousValues + begin, values1 + begin, 1, values2 + begin, 1, gradientValues1 + begin, gradientValues2 + begin,
+					end - begin);
+				return;
+			}
+			for (int i = begin; i < end; i++) {
+				gradientValues1[i] = previousValues[i] * operation.derivative1(values1[i], values2[i]);
+				gradientValues2[i] = previousValues[i] * operation.derivative2(values1[i], values2[i]);
+			}
+		});
 	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
-}
-
-std::vector<Tensor*> MultiplySingleFunction::getDependents() const {
-	return { original };
-}
-
-
-MultiplyTensorFunction::MultiplyTensorFunction(Tensor* original1, Tensor* original2, const std::vector<int>& broadcastedIndices1,
-	const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
-{
-
-}
-
-gradientList MultiplyTensorFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		gradientValues1[index1] += previousGradient.at(i) * original2->at(index2);
-		gradientValues2[index2] += previousGradient.at(i) * original1->at(index1);
+	else if (!Operation::savesInputs && previousGradient.isContiguous()) {
+		//The derivatives are constants, so the previous gradient is summed over the broadcast axes and scaled
+		std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(original1->getShape(), original2->getShape());
+		float derivatives[2] = { operation.derivative1(0.0f, 0.0f), operation.derivative2(0.0f, 0.0f) };
+		float* gradientValues[2] = { gradientValues1, gradientValues2 };
+		for (int i = 0; i < 2; i++) reduceGradient(previousValues, *plan, i, derivatives[i], gradientValues[i]);
+	}
+	else {
+		//Gradients are worked out in the broadcast shape, then summed over the axes each operand was broadcast along
+		std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(original1->getShape(), original2->getShape());
+		float* gradientValues[2] = { gradientValues1, gradientValues2 };
+		std::vector<float> broadcastGradients[2];
+		float* broadcastValues[2];
+		for (int i = 0; i < 2; i++) {
+			if (plan->reducedAxes[i].empty()) {
+				broadcastValues[i] = gradientValues[i];
+				continue;
+			}
+			broadcastGradients[i].resize(size);
+			broadcastValues[i] = broadcastGradients[i].data();
+		}
+		ThreadPool::parallelFor(size, [&](int begin, int end) {
+			BroadcastIterator iterator(previousGradient.getShape(), { &previousGradient, original1, original2 });
+			iterator.seek(begin);
+			for (int i = begin; i < end; i++, iterator.next()) {
+				float previous = previousValues[iterator.getOffset(0)];
+				float value1 = values1[iterator.getOffset(1)], value2 = values2[iterator.getOffset(2)];
+				broadcastValues[0][i] = previous * operation.derivative1(value1, value2);
+				broadcastValues[1][i] = previous * operation.derivative2(value1, value2);
+			}
+		});
+		for (int i = 0; i < 2; i++) {
+			if (!plan->reducedAxes[i].empty()) reduceGradient(broadcastValues[i], *plan, i, 1.0f, gradientValues[i]);
+		}
 	}
 
 	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
+		gradientTuple(original1, gradient1),
+		gradientTuple(original2, gradient2)
 	};
 }
 
-std::vector<Tensor*> MultiplyTensorFunction::getDependents() const {
+template<typename Operation>
+std::vector<Tensor*> ElementwiseFunction<Operation>::getDependents() const {
 	return { original1, original2 };
 }
 
-
-
-DivideSingleFunction::DivideSingleFunction(Tensor* original, float value) : original(original), value(value)
-{
-
-}
-
-gradientList DivideSingleFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = previousGradient.at(i) / value;
-	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
-}
-
-std::vector<Tensor*> DivideSingleFunction::getDependents() const {
-	return { original };
+template<typename Operation>
+std::vector<const Tensor*> ElementwiseFunction<Operation>::getSavedTensors() const {
+	if (Operation::savesInputs) return { original1, original2 };
+	return {};
 }
 
+#define INSTANTIATE_FUNCTIONS(Operation) \
+	template class ElementwiseSingleFunction<Operation>; \
+	template class ElementwiseFunction<Operation>;
+ELEMENTWISE_OPERATIONS(INSTANTIATE_FUNCTIONS)
 
-DivideTensorFunction::DivideTensorFunction(Tensor* original1, Tensor* original2, const std::vector<int>& broadcastedIndices1,
-	const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
-{
-
-}
-
-gradientList DivideTensorFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		gradientValues1[index1] += previousGradient.at(i) / original2->at(index2);
-		gradientValues2[index2] -= previousGradient.at(i) * original1->at(index1) / (original2->at(index2) * original2->at(index2));
-	}
-
-	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
-	};
-}
-
-std::vector<Tensor*> DivideTensorFunction::getDependents() const {
-	return { original1, original2 };
-}
-
-
-TransposeFunction::TransposeFunction(Tensor* original, const std::vector<int>& transposeIndices) : original(original), transposeIndices(transposeIndices)
+TransposeFunction::TransposeFunction(Tensor* original) : original(original)
 {
 
 }
 
 gradientList TransposeFunction::calculateGradient(Tensor& previousGradient) const
 {
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = previousGradient.at(transposeIndices[i]);
-	}
-	return gradientList{ gradientTuple(original, Tensor::fromValues(gradientValues, gradientShape)) };
+	//The gradient is a transposed view of the previous gradient, so no values are copied
+	return gradientList{ gradientTuple(original, previousGradient.detached().transpose()) };
 }
 
 std::vector<Tensor*> TransposeFunction::getDependents() const {
@@ -350,9 +463,7 @@ std::vector<Tensor*> TransposeFunction::getDependents() const {
 
 
 MatrixMultiplicationFunction::MatrixMultiplicationFunction(Tensor* original1, Tensor* original2,
-	const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2,
-	int matrixWidth, int matrixInner, int matrixHeight) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2), matrixWidth(matrixWidth),
+	int matrixWidth, int matrixInner, int matrixHeight) : original1(original1), original2(original2), matrixWidth(matrixWidth),
 	matrixInner(matrixInner), matrixHeight(matrixHeight)
 {
 
@@ -360,39 +471,58 @@ MatrixMultiplicationFunction::MatrixMultiplicationFunction(Tensor* original1, Te
 
 gradientList MatrixMultiplicationFunction::calculateGradient(Tensor& previousGradient) const
 {
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-	Tensor transpose1 = original2->detached().transpose();
-	Tensor unbroadcastedGradient1 = Tensor::matrixMultiply(previousGradient, transpose1);
-	int matrixSize1 = matrixWidth * matrixInner;
-	for (int i = 0; i < broadcastedIndices1.size(); i++) {
-		for (int j = 0; j < matrixSize1; j++) {
-			int broadcastedIndex = broadcastedIndices1[i] * matrixSize1 + j;
-			int unbroadcastedIndex = i * matrixSize1 + j;
-			gradientValues1[broadcastedIndex] += unbroadcastedGradient1.at(unbroadcastedIndex);
-		}
+	std::vector<int> batchShape = Tensor::getSubShape(previousGradient.getShape(), 0, 2);
+	int batchSize = Tensor::calculateSize(batchShape);
+
+	Tensor gradient1 = Tensor::zeroes(original1->getShape());
+	Tensor gradient2 = Tensor::zeroes(original2->getShape());
+	float* gradientValues1 = gradient1.getValues();
+	float* gradientValues2 = gradient2.getValues();
+
+	//Each gradient is multiplied straight into its matrices, reading the other input as its transpose where it is
+	readValues(previousGradient);
+	readValues(*original1);
+	readValues(*original2);
+	bool transposedPrevious, transposed1, transposed2;
+	int leadingDimensionPrevious, leadingDimension1, leadingDimension2;
+	Tensor previousMatrices = previousGradient.matrixView(transposedPrevious, leadingDimensionPrevious);
+	Tensor matrices1 = original1->matrixView(transposed1, leadingDimension1);
+	Tensor matrices2 = original2->matrixView(transposed2, leadingDimension2);
+
+	//Batch dimensions which an input was broadcast along are summed back into it
+	std::vector<int> batchShape1 = Tensor::getSubShape(original1->getShape(), 0, 2);
+	std::vector<int> batchShape2 = Tensor::getSubShape(original2->getShape(), 0, 2);
+	std::vector<std::vector<int>> batchShapes{ batchShape, batchShape1, batchShape2, batchShape1, batchShape2 };
+	std::vector<std::vector<int>> batchStrides;
+	for (const Tensor* tensor : { &previousMatrices, &matrices1, &matrices2, &gradient1, &gradient2 }) {
+		batchStrides.push_back(Tensor::getSubShape(tensor->strides, 0, 2));
 	}
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-	Tensor transpose2 = original1->detached().transpose();
-	Tensor unbroadcastedGradient2 = Tensor::matrixMultiply(transpose2, previousGradient);
-	int matrixSize2 = matrixInner * matrixHeight;
-	for (int i = 0; i < broadcastedIndices2.size(); i++) {
-		for (int j = 0; j < matrixSize2; j++) {
-			int broadcastedIndex = broadcastedIndices2[i] * matrixSize2 + j;
-			int unbroadcastedIndex = i * matrixSize2 + j;
-			gradientValues2[broadcastedIndex] += unbroadcastedGradient2.at(unbroadcastedIndex);
+	auto multiplyBatches = [&](int begin, int end) {
+		BroadcastIterator iterator(batchShape, batchShapes, batchStrides);
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			const float* previousMatrix = previousMatrices.values + iterator.getOffset(0);
+			gemm(transposedPrevious, !transposed2, matrixWidth, matrixInner, matrixHeight, previousMatrix,
+				leadingDimensionPrevious, matrices2.values + iterator.getOffset(2), leadingDimension2,
+				gradientValues1 + iterator.getOffset(3), matrixInner, true);
+			gemm(!transposed1, transposedPrevious, matrixInner, matrixHeight, matrixWidth,
+				matrices1.values + iterator.getOffset(1), leadingDimension1, previousMatrix, leadingDimensionPrevious,
+				gradientValues2 + iterator.getOffset(4), matrixHeight, true);
 		}
+	};
+	//Batches can only be split across threads when no two of them add to the same gradient matrix
+	bool separateBatches = Tensor::calculateSize(batchShape1) == batchSize && Tensor::calculateSize(batchShape2) == batchSize;
+	if (separateBatches && batchSize >= ThreadPool::getNumThreads()) {
+		long long matrixWork = 2LL * matrixWidth * matrixInner * matrixHeight;
+		ThreadPool::parallelFor(batchSize, multiplyBatches, (int)std::min<long long>(matrixWork, INT_MAX));
+	}
+	else {
+		multiplyBatches(0, batchSize);
 	}
 
 	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
+		gradientTuple(original1, gradient1),
+		gradientTuple(original2, gradient2)
 	};
 }
 
@@ -400,176 +530,120 @@ std::vector<Tensor*> MatrixMultiplicationFunction::getDependents() const {
 	return { original1, original2 };
 }
 
-MaxSingleFunction::MaxSingleFunction(Tensor* original, float value) : original(original), value(value)
-{
-
-}
-
-gradientList MaxSingleFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = original->at(i) >= value ? previousGradient.at(i) : 0;
-	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
+std::vector<const Tensor*> MatrixMultiplicationFunction::getSavedTensors() const {
+	return { original1, original2 };
 }
 
-std::vector<Tensor*> MaxSingleFunction::getDependents() const {
-	return { original };
-}
 
-MaxTensorFunction::MaxTensorFunction(Tensor* original1, Tensor* original2,
-	const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
+MeanSquaredErrorLossFunction::MeanSquaredErrorLossFunction(Tensor* original1, Tensor* original2, int broadcastedSize) :
+	original1(original1), original2(original2), broadcastedSize(broadcastedSize)
 {
 }
 
-gradientList MaxTensorFunction::calculateGradient(Tensor& previousGradient) const
+gradientList MeanSquaredErrorLossFunction::calculateGradient(Tensor& previousGradient) const
 {
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		if (original1->at(index1) >= original2->at(index2)) gradientValues1[index1] += previousGradient.at(i);
-		if (original2->at(index2) >= original1->at(index1)) gradientValues2[index2] += previousGradient.at(i);
-	}
+	Tensor gradient1 = Tensor::zeroes(original1->getShape());
+	Tensor gradient2 = Tensor::zeroes(original2->getShape());
+	const float* values1 = readValues(*original1);
+	const float* values2 = readValues(*original2);
+
+	std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(original1->getShape(), original2->getShape());
+	const std::vector<int>& broadcastedShape = plan->shape;
+	float coefficient = 2.0f * previousGradient.item() / broadcastedSize;
+	//The differences are written in the broadcast shape, and summed over the axes each input was broadcast along
+	std::vector<float> differences(broadcastedSize);
+	ThreadPool::parallelFor(broadcastedSize, [&](int begin, int end) {
+		BroadcastIterator iterator(broadcastedShape, { original1, original2 });
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			differences[i] = values1[iterator.getOffset(0)] - values2[iterator.getOffset(1)];
+		}
+	});
+	reduceGradient(differences.data(), *plan, 0, coefficient, gradient1.getValues());
+	reduceGradient(differences.data(), *plan, 1, -coefficient, gradient2.getValues());
 
 	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
+		gradientTuple(original1, gradient1),
+		gradientTuple(original2, gradient2)
 	};
 }
 
-std::vector<Tensor*> MaxTensorFunction::getDependents() const {
+std::vector<Tensor*> MeanSquaredErrorLossFunction::getDependents() const {
 	return { original1, original2 };
 }
 
-
-MinSingleFunction::MinSingleFunction(Tensor* original, float value) : original(original), value(value)
-{
-}
-
-gradientList MinSingleFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original->getSize();
-	const std::vector<int>& gradientShape = original->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) {
-		gradientValues[i] = original->at(i) <= value ? previousGradient.at(i) : 0;
-	}
-	return gradientList{ gradientTuple{original, Tensor::fromValues(gradientValues, gradientShape)} };
-}
-
-std::vector<Tensor*> MinSingleFunction::getDependents() const {
-	return { original };
+std::vector<const Tensor*> MeanSquaredErrorLossFunction::getSavedTensors() const {
+	return { original1, original2 };
 }
 
-MinTensorFunction::MinTensorFunction(Tensor* original1, Tensor* original2,
-	const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
+CategoricalCrossEntropyLossFunction::CategoricalCrossEntropyLossFunction(Tensor* original1, const Tensor* original2,
+	const std::shared_ptr<Storage>& softmaxValues, int finalDimSize, int broadcastedSize) :
+	original1(original1), original2(original2), softmaxValues(softmaxValues), finalDimSize(finalDimSize),
+	broadcastedSize(broadcastedSize)
 {
 }
 
-gradientList MinTensorFunction::calculateGradient(Tensor& previousGradient) const
+gradientList CategoricalCrossEntropyLossFunction::calculateGradient(Tensor& previousGradient) const
 {
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	for (int i = 0; i < previousGradient.getSize(); i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		if (original1->at(index1) <= original2->at(index2)) gradientValues1[index1] += previousGradient.at(i);
-		if (original2->at(index2) <= original1->at(index1)) gradientValues2[index2] += previousGradient.at(i);
-	}
+	int gradientSize = original1->getSize();
+	Tensor gradient = Tensor::zeroes(original1->getShape());
+	const float* softmax = softmaxValues->getValues();
+	const float* targetValues = readValues(*original2);
+
+	//The softmax values are laid out like the gradient, so they share its offsets
+	std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get(original1->getShape(), original2->getShape());
+	const std::vector<int>& broadcastedShape = plan->shape;
+	float coefficient = previousGradient.item() / (gradientSize / finalDimSize);
+	accumulateInParallel(broadcastedSize, { &gradient }, [&](int begin, int end, float* const* gradientValues) {
+		BroadcastIterator iterator(broadcastedShape, { &gradient, original2 });
+		iterator.seek(begin);
+		for (int i = begin; i < end; i++, iterator.next()) {
+			int index = iterator.getOffset(0);
+			gradientValues[0][index] += coefficient * (softmax[index] - targetValues[iterator.getOffset(1)]);
+		}
+	});
 
 	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
+		gradientTuple(original1, gradient)
 	};
 }
 
-std::vector<Tensor*> MinTensorFunction::getDependents() const {
-	return { original1, original2 };
+std::vector<Tensor*> CategoricalCrossEntropyLossFunction::getDependents() const {
+	return { original1 };
 }
 
+std::vector<const Tensor*> CategoricalCrossEntropyLossFunction::getSavedTensors() const {
+	return { original2 };
+}
 
-MeanSquaredErrorLossFunction::MeanSquaredErrorLossFunction(Tensor* original1, Tensor* original2, int broadcastedSize,
-	const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2) : original1(original1), original2(original2),
-	broadcastedSize(broadcastedSize), broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
+CheckpointFunction::CheckpointFunction(Tensor* original, const std::vector<layerFunction>& layers) :
+	original(original), layers(layers)
 {
 }
 
-gradientList MeanSquaredErrorLossFunction::calculateGradient(Tensor& previousGradient) const
+gradientList CheckpointFunction::calculateGradient(Tensor& previousGradient) const
 {
-	int gradientSize1 = original1->getSize();
-	const std::vector<int>& gradientShape1 = original1->getShape();
-	float* gradientValues1 = new float[gradientSize1];
-	for (int i = 0; i < gradientSize1; i++) gradientValues1[i] = 0;
-
-	int gradientSize2 = original2->getSize();
-	const std::vector<int>& gradientShape2 = original2->getShape();
-	float* gradientValues2 = new float[gradientSize2];
-	for (int i = 0; i < gradientSize2; i++) gradientValues2[i] = 0;
-
-	float coefficient = 2.0f / broadcastedSize;
-	for (int i = 0; i < broadcastedSize; i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		gradientValues1[index1] += coefficient * previousGradient.item() * (original1->at(index1) - original2->at(index2));
-		gradientValues2[index2] += coefficient * previousGradient.item() * (original2->at(index2) - original1->at(index1));
-	}
+	//Run the layers again, keeping every output and intermediate alive until their gradients have been propagated
+	std::vector<Tensor> outputs;
+	std::deque<Tensor> intermediates;
+	outputs.reserve(layers.size() + 1);
+	outputs.push_back(original->detached());
+	if (original->requiresGradient()) outputs.back().requireGradient();
+	for (const layerFunction& layer : layers) outputs.push_back(Tensor::runLayer(layer, outputs.back(), intermediates));
+	outputs.back().backwards(previousGradient);
 
-	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues1, gradientShape1)),
-		gradientTuple(original2, Tensor::fromValues(gradientValues2, gradientShape2))
-	};
+	if (!original->requiresGradient()) return {};
+	return gradientList{ gradientTuple(original, *outputs.front().getGradient()) };
 }
 
-std::vector<Tensor*> MeanSquaredErrorLossFunction::getDependents() const {
-	return { original1, original2 };
+std::vector<Tensor*> CheckpointFunction::getDependents() const {
+	return { original };
 }
 
-CategoricalCrossEntropyLossFunction::CategoricalCrossEntropyLossFunction(Tensor* original1, const Tensor* original2, float* softmaxValues,
-	int finalDimSize, int broadcastedSize, const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2) :
-	original1(original1), original2(original2), softmaxValues(softmaxValues), finalDimSize(finalDimSize),
-	broadcastedSize(broadcastedSize), broadcastedIndices1(broadcastedIndices1), broadcastedIndices2(broadcastedIndices2)
-{
+size_t CheckpointFunction::getSavedBytes() const {
+	return getVectorBytes(layers);
 }
 
-gradientList CategoricalCrossEntropyLossFunction::calculateGradient(Tensor& previousGradient) const
-{
-	int gradientSize = original1->getSize();
-	const std::vector<int>& gradientShape = original1->getShape();
-	float* gradientValues = new float[gradientSize];
-	for (int i = 0; i < gradientSize; i++) gradientValues[i] = 0;
-
-	for (int i = 0; i < broadcastedSize; i++) {
-		int index1 = broadcastedIndices1[i], index2 = broadcastedIndices2[i];
-		float pred = softmaxValues[index1], truth = original2->at(index2);
-		gradientValues[index1] += previousGradient.item() * (pred - truth);
-	}
-	for (int i = 0; i < gradientSize; i++) gradientValues[i] /= (gradientSize / finalDimSize);
-
-	return gradientList{
-		gradientTuple(original1, Tensor::fromValues(gradientValues, gradientShape))
-	};
+std::vector<const Tensor*> CheckpointFunction::getSavedTensors() const {
+	return { original };
 }
-
-std::vector<Tensor*> CategoricalCrossEntropyLossFunction::getDependents() const {
-	return { original1 };
-}
\ No newline at end of file
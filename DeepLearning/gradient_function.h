@@ -1,16 +1,64 @@
 #pragma once
 #include <vector>
 #include <tuple>
+#include <memory>
+#include <functional>
+
+#include "allocator.h"
+#include "storage.h"
+#include "elementwise.h"
 
 class Tensor;
 
 using gradientTuple = std::tuple<Tensor*, Tensor>;
 using gradientList = std::vector<gradientTuple>;
+using layerFunction = std::function<Tensor(Tensor&)>;
 
 class GradientFunction {
+private:
+	std::vector<int> savedVersions;
+	size_t trackedBytes = 0;
+protected:
+	// Bytes of metadata, such as broadcast indices, which are held by the function
+	virtual size_t getSavedBytes() const;
 public:
+	virtual ~GradientFunction();
 	virtual gradientList calculateGradient(Tensor& previousGradient) const = 0;
 	virtual std::vector<Tensor*> getDependents() const = 0;
+	// Tensors whose values are read by calculateGradient
+	virtual std::vector<const Tensor*> getSavedTensors() const;
+
+	// Records the versions of the saved tensors, so that checkVersions can throw if they were changed in place
+	void saveVersions();
+	void checkVersions() const;
+	// Counts the function object and its saved metadata in MemoryStats until it is destroyed
+	void trackMemory(size_t objectBytes);
+};
+
+// Inside a layer of Tensor::checkpoint, returns a copy of the tensor which lives until the gradients of the layer
+// have been computed, so that gradient functions do not refer to tensors which the layer has destroyed. Leaves which
+// require a gradient, and tensors outside of layers, are returned as they are.
+Tensor* keepDependent(const Tensor* tensor);
+
+template<typename T>
+T&& keepArgument(T&& argument) { return std::forward<T>(argument); }
+inline Tensor* keepArgument(Tensor* tensor) { return keepDependent(tensor); }
+inline const Tensor* keepArgument(const Tensor* tensor) { return keepDependent(tensor); }
+
+// Creates a gradient function in the active ArenaScope, or on the heap if there is none
+template<typename T, typename... Args>
+std::shared_ptr<GradientFunction> makeGradientFunction(Args&&... args) {
+	std::shared_ptr<GradientFunction> function = std::allocate_shared<T>(ArenaAllocator<T>(), keepArgument(std::forward<Args>(args))...);
+	function->saveVersions();
+	function->trackMemory(sizeof(T));
+	return function;
+}
+
+// Replaces the gradient function of a tensor once backwards has freed its graph
+class ReleasedFunction : public GradientFunction {
+public:
+	gradientList calculateGradient(Tensor& previousGradient) const override;
+	std::vector<Tensor*> getDependents() const override;
 };
 
 class GetFunction : public GradientFunction {
@@ -43,107 +91,60 @@ private:
 	int index;
 	int size;
 	std::vector<int> broadcastShape;
-	std::vector<int> broadcastedIndices;
+protected:
+	size_t getSavedBytes() const override;
 public:
-	SetTensorFunction(Tensor* copyTo, Tensor* copyFrom, int index, int size, const std::vector<int>& broadcastShape,
-		const std::vector<int>& broadcastedIndices);
+	SetTensorFunction(Tensor* copyTo, Tensor* copyFrom, int index, int size, const std::vector<int>& broadcastShape);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
 };
 
-class AddSingleFunction : public GradientFunction {
-private:
-	Tensor* original;
-public:
-	AddSingleFunction(Tensor* original);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class AddTensorFunction : public GradientFunction
-{
-private:
-	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
-public:
-	AddTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class SubtractSingleFunction : public GradientFunction {
-private:
-	Tensor* original;
-public:
-	SubtractSingleFunction(Tensor* original);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class SubtractTensorFunction : public GradientFunction
-{
-private:
-	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
-public:
-	SubtractTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class MultiplySingleFunction : public GradientFunction {
+// Gradient of an elementwise operation between a tensor and a constant
+template<typename Operation>
+class ElementwiseSingleFunction : public GradientFunction {
 private:
 	Tensor* original;
 	float value;
+	Operation operation;
 public:
-	MultiplySingleFunction(Tensor* original, float value);
+	ElementwiseSingleFunction(Tensor* original, float value, Operation operation = Operation());
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
 
-class MultiplyTensorFunction : public GradientFunction
-{
+// Gradient of an elementwise operation between two tensors, summed back over the dimensions each was broadcast along
+template<typename Operation>
+class ElementwiseFunction : public GradientFunction {
 private:
 	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
+	Operation operation;
 public:
-	MultiplyTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
+	ElementwiseFunction(Tensor* original1, Tensor* original2, Operation operation = Operation());
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
 
-class DivideSingleFunction : public GradientFunction {
-private:
-	Tensor* original;
-	float value;
-public:
-	DivideSingleFunction(Tensor* original, float value);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class DivideTensorFunction : public GradientFunction
-{
-private:
-	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
-public:
-	DivideTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
+using AddSingleFunction = ElementwiseSingleFunction<AddOperation>;
+using AddTensorFunction = ElementwiseFunction<AddOperation>;
+using SubtractSingleFunction = ElementwiseSingleFunction<SubtractOperation>;
+using SubtractTensorFunction = ElementwiseFunction<SubtractOperation>;
+using MultiplySingleFunction = ElementwiseSingleFunction<MultiplyOperation>;
+using MultiplyTensorFunction = ElementwiseFunction<MultiplyOperation>;
+using DivideSingleFunction = ElementwiseSingleFunction<DivideOperation>;
+using DivideTensorFunction = ElementwiseFunction<DivideOperation>;
+using MaxSingleFunction = ElementwiseSingleFunction<MaxOperation>;
+using MaxTensorFunction = ElementwiseFunction<MaxOperation>;
+using MinSingleFunction = ElementwiseSingleFunction<MinOperation>;
+using MinTensorFunction = ElementwiseFunction<MinOperation>;
 
 class TransposeFunction : public GradientFunction
 {
 private:
 	Tensor* original;
-	std::vector<int> transposeIndices;
 public:
-	TransposeFunction(Tensor* original, const std::vector<int>& transposeIndices);
+	TransposeFunction(Tensor* original);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
 };
@@ -152,87 +153,53 @@ class MatrixMultiplicationFunction : public GradientFunction
 {
 private:
 	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
 	int matrixWidth, matrixInner, matrixHeight;
 public:
 	MatrixMultiplicationFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2,
 		int matrixWidth, int matrixInner, int matrixHeight);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
 
-class MaxSingleFunction : public GradientFunction
-{
-private:
-	Tensor* original;
-	float value;
-public:
-	MaxSingleFunction(Tensor* original, float value);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class MaxTensorFunction : public GradientFunction
-{
-private:
-	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
-public:
-	MaxTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class MinSingleFunction : public GradientFunction
-{
-private:
-	Tensor* original;
-	float value;
-public:
-	MinSingleFunction(Tensor* original, float value);
-	gradientList calculateGradient(Tensor& previousGradient) const override;
-	std::vector<Tensor*> getDependents() const override;
-};
-
-class MinTensorFunction : public GradientFunction
+class MeanSquaredErrorLossFunction : public GradientFunction
 {
 private:
 	Tensor* original1, * original2;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
+	int broadcastedSize;
 public:
-	MinTensorFunction(Tensor* original1, Tensor* original2,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
+	MeanSquaredErrorLossFunction(Tensor* original1, Tensor* original2, int broadcastedSize);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
 
-class MeanSquaredErrorLossFunction : public GradientFunction
+class CategoricalCrossEntropyLossFunction : public GradientFunction
 {
 private:
-	Tensor* original1, * original2;
+	Tensor* original1;
+	const Tensor* original2;
+	std::shared_ptr<Storage> softmaxValues;
+	int finalDimSize;
 	int broadcastedSize;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
 public:
-	MeanSquaredErrorLossFunction(Tensor* original1, Tensor* original2, int broadcastedSize,
-		const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
+	CategoricalCrossEntropyLossFunction(Tensor* original1, const Tensor* orignal2, const std::shared_ptr<Storage>& softmaxValues, int finalDimSize,
+		int broadcastedSize);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
 
-class CategoricalCrossEntropyLossFunction : public GradientFunction
+class CheckpointFunction : public GradientFunction
 {
 private:
-	Tensor* original1;
-	const Tensor* original2;
-	float* softmaxValues;
-	int finalDimSize;
-	int broadcastedSize;
-	std::vector<int> broadcastedIndices1, broadcastedIndices2;
+	Tensor* original;
+	std::vector<layerFunction> layers;
+protected:
+	size_t getSavedBytes() const override;
 public:
-	CategoricalCrossEntropyLossFunction(Tensor* original1, const Tensor* orignal2, float* softmaxValues, int finalDimSize,
-		int broadcastedSize, const std::vector<int>& broadcastedIndices1, const std::vector<int>& broadcastedIndices2);
+	CheckpointFunction(Tensor* original, const std::vector<layerFunction>& layers);
 	gradientList calculateGradient(Tensor& previousGradient) const override;
 	std::vector<Tensor*> getDependents() const override;
+	std::vector<const Tensor*> getSavedTensors() const override;
 };
\ No newline at end of file
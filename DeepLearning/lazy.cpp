@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <mutex>
+
+#include "lazy.h"
+#include "broadcast_iterator.h"
+#include "thread_pool.h"
+
+namespace {
+	thread_local LazyScope* currentScope = nullptr;
+
+	//Held while pending operations run, so that a storage read from two threads is only computed once
+	std::recursive_mutex runMutex;
+
+	//Number of elements each operation is applied to at a time, small enough for the buffers of a chain to stay in cache
+	const int blockSize = 1024;
+
+	const size_t minimumCompactSize = 64;
+}
+
+// One operation of a fused chain. Each operand is the output of an earlier step, a tensor which is read directly,
+// or the constant of the node.
+struct LazyScope::Step {
+	const LazyNode* node;
+	Storage* storage;
+	SimdKernels kernels;
+	int operandSteps[2];
+	const Tensor* operands[2];
+	// Where the values are written, or null if they are only kept in the block buffer
+	float* output;
+};
+
+LazyScope::LazyScope() : previous(currentScope), compactSize(minimumCompactSize)
+{
+	currentScope = this;
+}
+
+LazyScope::~LazyScope()
+{
+	flush();
+	currentScope = previous;
+}
+
+bool LazyScope::isActive()
+{
+	return currentScope != nullptr;
+}
+
+void LazyScope::add(const std::shared_ptr<Storage>& storage)
+{
+	std::vector<std::weak_ptr<Storage>>& pending = currentScope->pending;
+	pending.push_back(storage);
+	//Storages which have been freed or run are dropped now and then, so long scopes do not grow the list forever
+	if (pending.size() >= currentScope->compactSize) {
+		pending.erase(std::remove_if(pending.begin(), pending.end(), [](const std::weak_ptr<Storage>& weak) {
+			std::shared_ptr<Storage> storage = weak.lock();
+			return !storage || !storage->getPending();
+		}), pending.end());
+		currentScope->compactSize = std::max(minimumCompactSize, pending.size() * 2);
+	}
+}
+
+int LazyScope::addStep(const std::shared_ptr<Storage>& storage, bool write, std::vector<Step>& steps,
+	std::unordered_map<Storage*, int>& stepIndices)
+{
+	const LazyNode* node = storage->getPending().get();
+	int size = storage->getSize();
+	if (write) storage->allocate();
+	Step step{ node, storage.get(), node->getKernels(), { -1, -1 }, { nullptr, nullptr }, storage->getValues() };
+	for (int i = 0; i < node->operands.size(); i++) {
+		const Tensor& operand = node->operands[i];
+		const std::shared_ptr<Storage>& operandStorage = operand.storage;
+		if (!operandStorage->getPending()) {
+			operand.realize();
+			step.operands[i] = &operand;
+			continue;
+		}
+
+		//Pending operands which cover the output element for element are computed in the same pass. Views with an
+		//offset run their operation when they are taken, so pending operands always start at the front of the storage.
+		bool fusable = operand.size == size && operandStorage->getSize() == size && operand.isContiguous();
+		if (!fusable) {
+			operand.realize();
+			step.operands[i] = &operand;
+			continue;
+		}
+		auto found = stepIndices.find(operandStorage.get());
+		if (found != stepIndices.end()) {
+			step.operandSteps[i] = found->second;
+			continue;
+		}
+		//The node holds one reference, so only values which anything else refers to are allocated and written out
+		step.operandSteps[i] = addStep(operandStorage, operandStorage.use_count() > 1, steps, stepIndices);
+	}
+
+	steps.push_back(step);
+	stepIndices[storage.get()] = steps.size() - 1;
+	return steps.size() - 1;
+}
+
+void LazyScope::run(const std::shared_ptr<Storage>& storage)
+{
+	std::lock_guard<std::recursive_mutex> lock(runMutex);
+	std::shared_ptr<LazyNode> node = storage->getPending();
+	if (!node) return;
+
+	std::vector<Step> steps;
+	std::unordered_map<Storage*, int> stepIndices;
+	addStep(storage, true, steps, stepIndices);
+
+	const std::vector<int>& shape = node->shape;
+	int size = storage->getSize();
+	int numSteps = steps.size();
+	int numBlocks = (size + blockSize - 1) / blockSize;
+	ThreadPool::parallelFor(numBlocks, [&](int beginBlock, int endBlock) {
+		//Every step has a buffer for its output and one for each operand which has to be gathered
+		std::vector<float> buffers(numSteps * 3 * blockSize);
+		std::vector<const float*> outputs(numSteps);
+		for (int block = beginBlock; block < endBlock; block++) {
+			int begin = block * blockSize;
+			int count = std::min(blockSize, size - begin);
+			for (int i = 0; i < numSteps; i++) {
+				const Step& step = steps[i];
+				float* stepBuffers = &buffers[i * 3 * blockSize];
+				const float* x[2] = { &step.node->value, &step.node->value };
+				int xStep[2] = { 0, 0 };
+				for (int j = 0; j < 2; j++) {
+					const Tensor* operand = step.operands[j];
+					if (step.operandSteps[j] >= 0) {
+						x[j] = outputs[step.operandSteps[j]];
+						xStep[j] = 1;
+					}
+					else if (!operand) {
+						continue;
+					}
+					else if (operand->size == size && operand->isContiguous()) {
+						x[j] = operand->values + begin;
+						xStep[j] = 1;
+					}
+					else if (operand->isConstant()) {
+						x[j] = operand->values;
+					}
+					else {
+						float* gathered = stepBuffers + (j + 1) * blockSize;
+						BroadcastIterator iterator(shape, { operand });
+						iterator.seek(begin);
+						for (int k = 0; k < count; k++, iterator.next()) gathered[k] = operand->values[iterator.getOffset(0)];
+						x[j] = gathered;
+						xStep[j] = 1;
+					}
+				}
+
+				float* out = step.output ? step.output + begin : stepBuffers;
+				if (step.kernels.forward) step.kernels.forward(x[0], xStep[0], x[1], xStep[1], out, count);
+				else for (int k = 0; k < count; k++) out[k] = step.node->apply(x[0][k * xStep[0]], x[1][k * xStep[1]]);
+				outputs[i] = out;
+			}
+		}
+	}, blockSize);
+
+	//Clearing a node can free the storages of the steps before it, so they are cleared in order
+	for (const Step& step : steps) step.storage->setPending(nullptr);
+}
+
+void LazyScope::flush()
+{
+	for (LazyScope* scope = currentScope; scope; scope = scope->previous) {
+		std::vector<std::weak_ptr<Storage>> pending;
+		pending.swap(scope->pending);
+		//Later operations run first, so that the intermediates they are fused with are not written out
+		for (auto weak = pending.rbegin(); weak != pending.rend(); ++weak) {
+			std::shared_ptr<Storage> storage = weak->lock();
+			if (storage) run(storage);
+		}
+		scope->compactSize = minimumCompactSize;
+	}
+}
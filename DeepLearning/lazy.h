@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "deep_learning.h"
+#include "simd.h"
+#include "broadcast_plan.h"
+
+template<typename Operation>
+float applyOperation(float x, float y)
+{
+	return Operation()(x, y);
+}
+
+// Elementwise operation recorded in a LazyScope, held by the storage it will write its values to
+struct LazyNode {
+	float (*apply)(float x, float y);
+	SimdKernels (*getKernels)();
+	// Detached views of the operands, which keep their values alive until the node has run. Operations with a
+	// constant have one operand, and the constant is value.
+	std::vector<Tensor> operands;
+	float value;
+	std::vector<int> shape;
+};
+
+// While a LazyScope is alive, elementwise operations on this thread record themselves instead of running. Their
+// buffers are only allocated and written once something reads them, such as item, at, get, getValues or another
+// operation which is not lazy. At that point chains of pending operations with the same shape run together over
+// blocks which fit in cache, and intermediates which no other tensor refers to are never allocated.
+// In-place operations and the end of the scope first run everything still pending on this thread, so no operation
+// sees values written after it was recorded. Writes through getValues do not, like writes through views.
+class LazyScope {
+private:
+	struct Step;
+
+	LazyScope* previous;
+	std::vector<std::weak_ptr<Storage>> pending;
+	size_t compactSize;
+
+	// Remembers a pending storage in the innermost scope, so that it can be run by flush
+	static void add(const std::shared_ptr<Storage>& storage);
+	static int addStep(const std::shared_ptr<Storage>& storage, bool write, std::vector<Step>& steps,
+		std::unordered_map<Storage*, int>& stepIndices);
+public:
+	LazyScope();
+	~LazyScope();
+
+	LazyScope(const LazyScope&) = delete;
+	LazyScope& operator=(const LazyScope&) = delete;
+
+	static bool isActive();
+	// Creates the output of an operation between input and other, or input and value when other is null
+	template<typename Operation> static Tensor record(const Tensor& input, const Tensor* other, float value);
+	// Computes the values of a storage, along with the pending operations it can be fused with
+	static void run(const std::shared_ptr<Storage>& storage);
+	// Runs every operation still pending in the scopes of this thread
+	static void flush();
+};
+
+template<typename Operation>
+Tensor LazyScope::record(const Tensor& input, const Tensor* other, float value)
+{
+	auto node = std::make_shared<LazyNode>();
+	node->apply = &applyOperation<Operation>;
+	node->getKernels = &getSimdKernels<Operation>;
+	node->operands.push_back(input.detached());
+	if (other) node->operands.push_back(other->detached());
+	node->value = value;
+	node->shape = other ? BroadcastPlan::get(input.shape, other->shape)->shape : input.shape;
+
+	int size = Tensor::calculateSize(node->shape);
+	Tensor newTensor(node->shape, size, Storage::create(size, true));
+	newTensor.storage->setPending(node);
+	add(newTensor.storage);
+	return newTensor;
+}
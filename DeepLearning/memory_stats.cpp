@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <atomic>
+
+#include "memory_stats.h"
+
+namespace {
+	std::atomic<long long> liveBytes[3];
+	std::atomic<long long> totalBytes(0);
+	std::atomic<long long> peakBytes(0);
+
+	thread_local MemoryScope* currentScope = nullptr;
+
+	long long* getCounter(MemoryUsage& usage, MemoryCategory category)
+	{
+		switch (category) {
+		case MemoryCategory::Tensor: return &usage.tensorBytes;
+		case MemoryCategory::Gradient: return &usage.gradientBytes;
+		default: return &usage.savedBytes;
+		}
+	}
+}
+
+long long MemoryUsage::getLiveBytes() const
+{
+	return tensorBytes + gradientBytes + savedBytes;
+}
+
+void MemoryStats::allocate(MemoryCategory category, long long bytes)
+{
+	liveBytes[(int)category] += bytes;
+	long long total = totalBytes += bytes;
+	long long peak = peakBytes.load();
+	while (total > peak && !peakBytes.compare_exchange_weak(peak, total));
+	for (MemoryScope* scope = currentScope; scope; scope = scope->parent) scope->update(category, bytes);
+}
+
+void MemoryStats::deallocate(MemoryCategory category, long long bytes)
+{
+	liveBytes[(int)category] -= bytes;
+	totalBytes -= bytes;
+	for (MemoryScope* scope = currentScope; scope; scope = scope->parent) scope->update(category, -bytes);
+}
+
+MemoryUsage MemoryStats::getUsage()
+{
+	MemoryUsage usage;
+	usage.tensorBytes = liveBytes[(int)MemoryCategory::Tensor];
+	usage.gradientBytes = liveBytes[(int)MemoryCategory::Gradient];
+	usage.savedBytes = liveBytes[(int)MemoryCategory::Saved];
+	usage.peakBytes = peakBytes;
+	return usage;
+}
+
+void MemoryStats::resetPeak()
+{
+	peakBytes = totalBytes.load();
+}
+
+MemoryScope::MemoryScope() : parent(currentScope)
+{
+	reset();
+	currentScope = this;
+}
+
+MemoryScope::~MemoryScope()
+{
+	currentScope = parent;
+}
+
+void MemoryScope::update(MemoryCategory category, long long bytes)
+{
+	*getCounter(usage, category) += bytes;
+	usage.peakBytes = std::max(usage.peakBytes, usage.getLiveBytes());
+}
+
+const MemoryUsage& MemoryScope::getUsage() const
+{
+	return usage;
+}
+
+void MemoryScope::reset()
+{
+	usage = MemoryUsage{ 0, 0, 0, 0 };
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+
+enum class MemoryCategory {
+	Tensor,
+	Gradient,
+	Saved
+};
+
+// Bytes held by the library, split into tensor values, gradient buffers and metadata saved by gradient functions
+struct MemoryUsage {
+	long long tensorBytes;
+	long long gradientBytes;
+	long long savedBytes;
+	long long peakBytes;
+
+	long long getLiveBytes() const;
+};
+
+// Counts the bytes which are live across all threads, and the peak of their total
+class MemoryStats {
+public:
+	static void allocate(MemoryCategory category, long long bytes);
+	static void deallocate(MemoryCategory category, long long bytes);
+
+	static MemoryUsage getUsage();
+	// Lowers the peak to the bytes which are currently live
+	static void resetPeak();
+};
+
+// Counts the bytes allocated minus the bytes freed on this thread while the scope is alive, and the peak of
+// their total. Scopes can be nested, in which case all of them are updated.
+class MemoryScope {
+private:
+	MemoryUsage usage;
+	MemoryScope* parent;
+
+	void update(MemoryCategory category, long long bytes);
+	friend class MemoryStats;
+public:
+	MemoryScope();
+	~MemoryScope();
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+
+	const MemoryUsage& getUsage() const;
+	void reset();
+};
@@ -0,0 +1,37 @@
+#include <stdexcept>
+
+#include "packed_weights.h"
+
+PackedWeights::PackedWeights(Tensor& weights) : weights(&weights), values(nullptr), version(0)
+{
+}
+
+Tensor& PackedWeights::getWeights() const
+{
+	return *weights;
+}
+
+const PackedMatrix& PackedWeights::get()
+{
+	const Tensor& tensor = *weights;
+	if (tensor.shape.size() != 2) throw std::length_error("Packed weights must have 2 dims.");
+	tensor.realize();
+	if (storage.lock() == tensor.storage && values == tensor.values && strides == tensor.strides &&
+		version == tensor.storage->getVersion() && packed.getDepth() == tensor.shape[0] &&
+		packed.getColumns() == tensor.shape[1]) return packed;
+
+	bool transposed;
+	int leadingDimension;
+	Tensor matrix = tensor.matrixView(transposed, leadingDimension);
+	packed.pack(transposed, tensor.shape[0], tensor.shape[1], matrix.values, leadingDimension);
+	storage = tensor.storage;
+	values = tensor.values;
+	strides = tensor.strides;
+	version = tensor.storage->getVersion();
+	return packed;
+}
+
+void PackedWeights::invalidate()
+{
+	storage.reset();
+}
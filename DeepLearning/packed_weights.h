@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+#include "deep_learning.h"
+#include "gemm.h"
+
+// Weight matrix kept in the packed layout of gemm, for weights which are multiplied by many inputs between changes.
+// Tensor::matrixMultiply repacks them on the first product after they are modified in place, which changes the
+// version of their storage, or after the tensor is assigned other values. Writes through the pointer returned by
+// getValues are not versioned, so invalidate has to be called after them.
+class PackedWeights {
+private:
+	Tensor* weights;
+	PackedMatrix packed;
+	std::weak_ptr<Storage> storage;
+	const float* values;
+	std::vector<int> strides;
+	int version;
+public:
+	PackedWeights(Tensor& weights);
+
+	Tensor& getWeights() const;
+	// Packs the weights if they have changed since they were last packed
+	const PackedMatrix& get();
+	void invalidate();
+};
@@ -0,0 +1,104 @@
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "simd.h"
+#include "simd_kernels.h"
+
+namespace {
+	void cpuid(int leaf, int registers[4])
+	{
+#ifdef _MSC_VER
+		__cpuidex(registers, leaf, 0);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, 0, a, b, c, d);
+		registers[0] = a; registers[1] = b; registers[2] = c; registers[3] = d;
+#endif
+	}
+
+	//Register state which the operating system saves on context switches
+	unsigned long long getEnabledState()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int low, high;
+		__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return ((unsigned long long)high << 32) | low;
+#endif
+	}
+
+	SimdLevel detectSimdLevel()
+	{
+		int registers[4];
+		cpuid(0, registers);
+		int maxLeaf = registers[0];
+
+		cpuid(1, registers);
+		if (!(registers[3] & (1 << 26))) return SimdLevel::Scalar;
+		//AVX registers can only be used once the operating system has enabled them with XSAVE
+		bool osxsave = registers[2] & (1 << 27), avx = registers[2] & (1 << 28), fma = registers[2] & (1 << 12);
+		if (!osxsave || !avx || maxLeaf < 7) return SimdLevel::SSE2;
+		unsigned long long state = getEnabledState();
+		if ((state & 0x6) != 0x6) return SimdLevel::SSE2;
+
+		cpuid(7, registers);
+		bool avx2 = registers[1] & (1 << 5), avx512 = registers[1] & (1 << 16);
+		if (avx512 && (state & 0xe6) == 0xe6) return SimdLevel::AVX512;
+		//The AVX2 kernels use FMA, which every processor with AVX2 so far also has
+		if (avx2 && fma) return SimdLevel::AVX2;
+		return SimdLevel::SSE2;
+	}
+
+	std::atomic<SimdLevel>& currentLevel()
+	{
+		static std::atomic<SimdLevel> level(getSupportedSimdLevel());
+		return level;
+	}
+}
+
+SimdLevel getSupportedSimdLevel()
+{
+	static const SimdLevel level = detectSimdLevel();
+	return level;
+}
+
+SimdLevel getSimdLevel()
+{
+	return currentLevel().load(std::memory_order_relaxed);
+}
+
+void setSimdLevel(SimdLevel level)
+{
+	if (level > getSupportedSimdLevel()) level = getSupportedSimdLevel();
+	currentLevel().store(level, std::memory_order_relaxed);
+}
+
+template<typename Operation>
+SimdKernels getSimdKernels()
+{
+	switch (getSimdLevel()) {
+	case SimdLevel::AVX512: return getAvx512Kernels<Operation>();
+	case SimdLevel::AVX2: return getAvx2Kernels<Operation>();
+	case SimdLevel::SSE2: return getSse2Kernels<Operation>();
+	default: return SimdKernels{ nullptr, nullptr };
+	}
+}
+
+#define INSTANTIATE_KERNELS(Operation) template SimdKernels getSimdKernels<Operation>();
+ELEMENTWISE_OPERATIONS(INSTANTIATE_KERNELS)
+
+GemmKernel getGemmKernel()
+{
+	switch (getSimdLevel()) {
+	case SimdLevel::AVX512: return getAvx512GemmKernel();
+	case SimdLevel::AVX2: return getAvx2GemmKernel();
+	case SimdLevel::SSE2: return getSse2GemmKernel();
+	default: return GemmKernel{ 0, 0, nullptr };
+	}
+}
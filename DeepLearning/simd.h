@@ -0,0 +1,48 @@
+#pragma once
+
+// Instruction sets which the elementwise kernels can use, in order of vector width
+enum class SimdLevel {
+	Scalar,
+	SSE2,
+	AVX2,
+	AVX512
+};
+
+// Kernels over contiguous values. Operands with a step of 0 are a single value which is broadcast, and operands with
+// a step of 1 are read in order. backward writes previous * derivative1 to gradient1, and previous * derivative2 to
+// gradient2 unless it is null.
+using forwardKernel = void(*)(const float* x, int xStep, const float* y, int yStep, float* out, int size);
+using backwardKernel = void(*)(const float* previous, const float* x, int xStep, const float* y, int yStep,
+	float* gradient1, float* gradient2, int size);
+
+struct SimdKernels {
+	forwardKernel forward;
+	backwardKernel backward;
+};
+
+// Widest instruction set supported by both the processor and the operating system, detected once with CPUID
+SimdLevel getSupportedSimdLevel();
+// Instruction set used by the kernels, which defaults to the supported level
+SimdLevel getSimdLevel();
+// Limits the kernels to an instruction set, clamped to the supported level
+void setSimdLevel(SimdLevel level);
+
+// Kernels for an operation from elementwise.h at the current level. Both are null at SimdLevel::Scalar, where the
+// callers use their own loops.
+template<typename Operation> SimdKernels getSimdKernels();
+
+// Multiplies a strip of tileRows rows of a, packed column by column, by a strip of tileColumns columns of b, packed
+// row by row, over depth. The first rows x columns values of the tile are written to out, or added to it if
+// accumulate is set. Both strips start on a tensorAlignment boundary.
+using gemmKernel = void(*)(int depth, const float* packedA, const float* packedB, float* out, int ldOut, int rows,
+	int columns, bool accumulate);
+
+struct GemmKernel {
+	int tileRows;
+	int tileColumns;
+	gemmKernel multiplyTile;
+};
+
+// Register-blocked kernel for the current level, which uses FMA from AVX2 on. multiplyTile is null at
+// SimdLevel::Scalar, where gemm uses its own loop.
+GemmKernel getGemmKernel();
@@ -0,0 +1,57 @@
+// Elementwise and matrix multiplication kernels for AVX2. Built for the instruction set, so see simd_kernels.h
+// before adding includes.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC target("avx2,fma")
+#elif defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#endif
+
+#include <immintrin.h>
+
+#include "simd_kernels.h"
+
+namespace {
+	struct Avx2Vector {
+		static const int width = 8;
+		__m256 value;
+
+		Avx2Vector() {}
+		Avx2Vector(__m256 value) : value(value) {}
+		Avx2Vector(float value) : value(_mm256_set1_ps(value)) {}
+
+		static Avx2Vector load(const float* values) { return _mm256_loadu_ps(values); }
+		static Avx2Vector loadAligned(const float* values) { return _mm256_load_ps(values); }
+		void store(float* values) const { _mm256_storeu_ps(values, value); }
+	};
+
+	Avx2Vector operator+(Avx2Vector x, Avx2Vector y) { return _mm256_add_ps(x.value, y.value); }
+	Avx2Vector operator-(Avx2Vector x, Avx2Vector y) { return _mm256_sub_ps(x.value, y.value); }
+	Avx2Vector operator*(Avx2Vector x, Avx2Vector y) { return _mm256_mul_ps(x.value, y.value); }
+	Avx2Vector operator/(Avx2Vector x, Avx2Vector y) { return _mm256_div_ps(x.value, y.value); }
+	Avx2Vector multiplyAdd(Avx2Vector x, Avx2Vector y, Avx2Vector z) { return _mm256_fmadd_ps(x.value, y.value, z.value); }
+	Avx2Vector operator-(Avx2Vector x) { return _mm256_xor_ps(x.value, _mm256_set1_ps(-0.0f)); }
+	Avx2Vector maximum(Avx2Vector x, Avx2Vector y) { return _mm256_max_ps(y.value, x.value); }
+	Avx2Vector minimum(Avx2Vector x, Avx2Vector y) { return _mm256_min_ps(y.value, x.value); }
+	Avx2Vector ifGreaterEqual(Avx2Vector x, Avx2Vector y, Avx2Vector value)
+	{
+		return _mm256_and_ps(_mm256_cmp_ps(x.value, y.value, _CMP_GE_OQ), value.value);
+	}
+}
+
+template<typename Operation>
+SimdKernels getAvx2Kernels()
+{
+	return makeSimdKernels<Avx2Vector, Operation>();
+}
+
+#define INSTANTIATE_KERNELS(Operation) template SimdKernels getAvx2Kernels<Operation>();
+ELEMENTWISE_OPERATIONS(INSTANTIATE_KERNELS)
+
+GemmKernel getAvx2GemmKernel()
+{
+	return makeGemmKernel<Avx2Vector, 6, 2>();
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,60 @@
+// Elementwise and matrix multiplication kernels for AVX-512. Built for the instruction set, so see simd_kernels.h
+// before adding includes.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC target("avx512f")
+#elif defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#endif
+
+#include <immintrin.h>
+
+#include "simd_kernels.h"
+
+namespace {
+	struct Avx512Vector {
+		static const int width = 16;
+		__m512 value;
+
+		Avx512Vector() {}
+		Avx512Vector(__m512 value) : value(value) {}
+		Avx512Vector(float value) : value(_mm512_set1_ps(value)) {}
+
+		static Avx512Vector load(const float* values) { return _mm512_loadu_ps(values); }
+		static Avx512Vector loadAligned(const float* values) { return _mm512_load_ps(values); }
+		void store(float* values) const { _mm512_storeu_ps(values, value); }
+	};
+
+	Avx512Vector operator+(Avx512Vector x, Avx512Vector y) { return _mm512_add_ps(x.value, y.value); }
+	Avx512Vector operator-(Avx512Vector x, Avx512Vector y) { return _mm512_sub_ps(x.value, y.value); }
+	Avx512Vector operator*(Avx512Vector x, Avx512Vector y) { return _mm512_mul_ps(x.value, y.value); }
+	Avx512Vector operator/(Avx512Vector x, Avx512Vector y) { return _mm512_div_ps(x.value, y.value); }
+	Avx512Vector multiplyAdd(Avx512Vector x, Avx512Vector y, Avx512Vector z) { return _mm512_fmadd_ps(x.value, y.value, z.value); }
+	Avx512Vector operator-(Avx512Vector x)
+	{
+		return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x.value), _mm512_set1_epi32((int)0x80000000)));
+	}
+	Avx512Vector maximum(Avx512Vector x, Avx512Vector y) { return _mm512_max_ps(y.value, x.value); }
+	Avx512Vector minimum(Avx512Vector x, Avx512Vector y) { return _mm512_min_ps(y.value, x.value); }
+	Avx512Vector ifGreaterEqual(Avx512Vector x, Avx512Vector y, Avx512Vector value)
+	{
+		return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x.value, y.value, _CMP_GE_OQ), value.value);
+	}
+}
+
+template<typename Operation>
+SimdKernels getAvx512Kernels()
+{
+	return makeSimdKernels<Avx512Vector, Operation>();
+}
+
+#define INSTANTIATE_KERNELS(Operation) template SimdKernels getAvx512Kernels<Operation>();
+ELEMENTWISE_OPERATIONS(INSTANTIATE_KERNELS)
+
+GemmKernel getAvx512GemmKernel()
+{
+	return makeGemmKernel<Avx512Vector, 12, 2>();
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,151 @@
+#pragma once
+#include "simd.h"
+#include "elementwise.h"
+
+// Shared by the files which compile the kernels for one instruction set each. Those files are built for their
+// instruction set, so nothing here may use the standard library, whose inline functions could be merged with the
+// copies in the rest of the program.
+
+template<typename Operation> SimdKernels getSse2Kernels();
+template<typename Operation> SimdKernels getAvx2Kernels();
+template<typename Operation> SimdKernels getAvx512Kernels();
+GemmKernel getSse2GemmKernel();
+GemmKernel getAvx2GemmKernel();
+GemmKernel getAvx512GemmKernel();
+
+// Vector wraps one register of its instruction set, and provides width, load, loadAligned, store, construction from
+// nothing or a float, multiplyAdd and the operators used by elementwise.h. Values past the last full vector are copied through a padded buffer so that
+// no float code is compiled for the instruction set.
+template<typename Vector, typename Operation>
+void vectorForward(const float* x, int xStep, const float* y, int yStep, float* out, int size)
+{
+	const int width = Vector::width;
+	Operation operation;
+	Vector xValue(xStep ? 0.0f : *x), yValue(yStep ? 0.0f : *y);
+	int i = 0;
+	for (; i + width <= size; i += width) {
+		if (xStep) xValue = Vector::load(x + i);
+		if (yStep) yValue = Vector::load(y + i);
+		operation(xValue, yValue).store(out + i);
+	}
+	if (i < size) {
+		float xBuffer[width], yBuffer[width], outBuffer[width];
+		for (int j = 0; j < width; j++) {
+			xBuffer[j] = i + j < size ? x[(i + j) * xStep] : 1.0f;
+			yBuffer[j] = i + j < size ? y[(i + j) * yStep] : 1.0f;
+		}
+		operation(Vector::load(xBuffer), Vector::load(yBuffer)).store(outBuffer);
+		for (int j = 0; i + j < size; j++) out[i + j] = outBuffer[j];
+	}
+}
+
+template<typename Vector, typename Operation>
+void vectorBackward(const float* previous, const float* x, int xStep, const float* y, int yStep,
+	float* gradient1, float* gradient2, int size)
+{
+	const int width = Vector::width;
+	Operation operation;
+	Vector xValue(xStep ? 0.0f : *x), yValue(yStep ? 0.0f : *y);
+	int i = 0;
+	for (; i + width <= size; i += width) {
+		if (xStep) xValue = Vector::load(x + i);
+		if (yStep) yValue = Vector::load(y + i);
+		Vector previousValue = Vector::load(previous + i);
+		(previousValue * operation.derivative1(xValue, yValue)).store(gradient1 + i);
+		if (gradient2) (previousValue * operation.derivative2(xValue, yValue)).store(gradient2 + i);
+	}
+	if (i < size) {
+		float previousBuffer[width], xBuffer[width], yBuffer[width], outBuffer[width];
+		for (int j = 0; j < width; j++) {
+			previousBuffer[j] = i + j < size ? previous[i + j] : 0.0f;
+			xBuffer[j] = i + j < size ? x[(i + j) * xStep] : 1.0f;
+			yBuffer[j] = i + j < size ? y[(i + j) * yStep] : 1.0f;
+		}
+		Vector previousValue = Vector::load(previousBuffer);
+		xValue = Vector::load(xBuffer);
+		yValue = Vector::load(yBuffer);
+		(previousValue * operation.derivative1(xValue, yValue)).store(outBuffer);
+		for (int j = 0; i + j < size; j++) gradient1[i + j] = outBuffer[j];
+		if (gradient2) {
+			(previousValue * operation.derivative2(xValue, yValue)).store(outBuffer);
+			for (int j = 0; i + j < size; j++) gradient2[i + j] = outBuffer[j];
+		}
+	}
+}
+
+template<typename Vector, typename Operation>
+SimdKernels makeSimdKernels()
+{
+	return SimdKernels{ &vectorForward<Vector, Operation>, &vectorBackward<Vector, Operation> };
+}
+
+// Calls function(i) for every i below count, written out at compile time so that arrays indexed by i inside a kernel
+// can be kept in registers
+template<int count>
+struct Unroll {
+	template<typename Function> static void run(Function function)
+	{
+		Unroll<count - 1>::run(function);
+		function(count - 1);
+	}
+};
+
+template<>
+struct Unroll<0> {
+	template<typename Function> static void run(Function) {}
+};
+
+// Keeps a tile of rows x vectors registers of out in registers while stepping through the packed strips, so each step
+// loads one row of b and multiplies it with every value in a column of a. Edge tiles go through a buffer, like the
+// ends of the elementwise kernels.
+template<typename Vector, int rows, int vectors>
+void vectorMultiplyTile(int depth, const float* packedA, const float* packedB, float* out, int ldOut, int usedRows,
+	int usedColumns, bool accumulate)
+{
+	const int width = Vector::width;
+	const int columns = vectors * width;
+	Vector tile[rows][vectors];
+	Unroll<rows>::run([&](int i) {
+		Unroll<vectors>::run([&](int j) { tile[i][j] = Vector(0.0f); });
+	});
+	for (int p = 0; p < depth; p++, packedA += rows, packedB += columns) {
+		Vector bRow[vectors];
+		Unroll<vectors>::run([&](int j) { bRow[j] = Vector::loadAligned(packedB + j * width); });
+		Unroll<rows>::run([&](int i) {
+			Vector aValue(packedA[i]);
+			Unroll<vectors>::run([&](int j) { tile[i][j] = multiplyAdd(aValue, bRow[j], tile[i][j]); });
+		});
+	}
+
+	if (usedRows == rows && usedColumns == columns) {
+		for (int i = 0; i < rows; i++) {
+			for (int j = 0; j < vectors; j++) {
+				float* outValues = out + i * ldOut + j * width;
+				if (accumulate) (tile[i][j] + Vector::load(outValues)).store(outValues);
+				else tile[i][j].store(outValues);
+			}
+		}
+		return;
+	}
+	float buffer[rows * columns];
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < columns; j++) {
+			buffer[i * columns + j] = accumulate && i < usedRows && j < usedColumns ? out[i * ldOut + j] : 0.0f;
+		}
+	}
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < vectors; j++) {
+			float* bufferValues = buffer + i * columns + j * width;
+			(tile[i][j] + Vector::load(bufferValues)).store(bufferValues);
+		}
+	}
+	for (int i = 0; i < usedRows; i++) {
+		for (int j = 0; j < usedColumns; j++) out[i * ldOut + j] = buffer[i * columns + j];
+	}
+}
+
+template<typename Vector, int rows, int vectors>
+GemmKernel makeGemmKernel()
+{
+	return GemmKernel{ rows, vectors * Vector::width, &vectorMultiplyTile<Vector, rows, vectors> };
+}
@@ -0,0 +1,57 @@
+// Elementwise and matrix multiplication kernels for SSE2. Built for the instruction set, so see simd_kernels.h
+// before adding includes.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC target("sse2")
+#elif defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#endif
+
+#include <immintrin.h>
+
+#include "simd_kernels.h"
+
+namespace {
+	struct Sse2Vector {
+		static const int width = 4;
+		__m128 value;
+
+		Sse2Vector() {}
+		Sse2Vector(__m128 value) : value(value) {}
+		Sse2Vector(float value) : value(_mm_set1_ps(value)) {}
+
+		static Sse2Vector load(const float* values) { return _mm_loadu_ps(values); }
+		static Sse2Vector loadAligned(const float* values) { return _mm_load_ps(values); }
+		void store(float* values) const { _mm_storeu_ps(values, value); }
+	};
+
+	Sse2Vector operator+(Sse2Vector x, Sse2Vector y) { return _mm_add_ps(x.value, y.value); }
+	Sse2Vector operator-(Sse2Vector x, Sse2Vector y) { return _mm_sub_ps(x.value, y.value); }
+	Sse2Vector operator*(Sse2Vector x, Sse2Vector y) { return _mm_mul_ps(x.value, y.value); }
+	Sse2Vector operator/(Sse2Vector x, Sse2Vector y) { return _mm_div_ps(x.value, y.value); }
+	Sse2Vector multiplyAdd(Sse2Vector x, Sse2Vector y, Sse2Vector z) { return _mm_add_ps(_mm_mul_ps(x.value, y.value), z.value); }
+	Sse2Vector operator-(Sse2Vector x) { return _mm_xor_ps(x.value, _mm_set1_ps(-0.0f)); }
+	Sse2Vector maximum(Sse2Vector x, Sse2Vector y) { return _mm_max_ps(y.value, x.value); }
+	Sse2Vector minimum(Sse2Vector x, Sse2Vector y) { return _mm_min_ps(y.value, x.value); }
+	Sse2Vector ifGreaterEqual(Sse2Vector x, Sse2Vector y, Sse2Vector value)
+	{
+		return _mm_and_ps(_mm_cmpge_ps(x.value, y.value), value.value);
+	}
+}
+
+template<typename Operation>
+SimdKernels getSse2Kernels()
+{
+	return makeSimdKernels<Sse2Vector, Operation>();
+}
+
+#define INSTANTIATE_KERNELS(Operation) template SimdKernels getSse2Kernels<Operation>();
+ELEMENTWISE_OPERATIONS(INSTANTIATE_KERNELS)
+
+GemmKernel getSse2GemmKernel()
+{
+	return makeGemmKernel<Sse2Vector, 6, 2>();
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,96 @@
+#include "storage.h"
+#include "allocator.h"
+
+Storage::Storage(int size) : Storage(size, nullptr)
+{
+}
+
+Storage::Storage(int size, Arena* arena, bool deferred) : values(nullptr), size(size), cached(arena == nullptr),
+arena(arena), version(0), category(MemoryCategory::Tensor)
+{
+	if (!deferred) allocate();
+}
+
+Storage::Storage(float* values, int size) : values(values), size(size), cached(false), arena(nullptr), version(0),
+category(MemoryCategory::Tensor)
+{
+	MemoryStats::allocate(category, size * sizeof(float));
+}
+
+Storage::~Storage()
+{
+	//Deferred storages which were never allocated have nothing to free
+	if (!values) return;
+	MemoryStats::deallocate(category, size * sizeof(float));
+	if (arena) arena->release();
+	else if (cached) CachingAllocator::deallocate(values, size);
+	else delete[] values;
+}
+
+float* Storage::getValues() const
+{
+	return values;
+}
+
+void Storage::allocate()
+{
+	if (values) return;
+	MemoryStats::allocate(category, size * sizeof(float));
+	if (arena) values = static_cast<float*>(arena->allocate(size * sizeof(float), tensorAlignment));
+	else values = CachingAllocator::allocate(size);
+}
+
+int Storage::getSize() const
+{
+	return size;
+}
+
+Arena* Storage::getArena() const
+{
+	return arena;
+}
+
+int Storage::getVersion() const
+{
+	return version;
+}
+
+void Storage::incrementVersion()
+{
+	version++;
+}
+
+void Storage::setVersion(int version)
+{
+	this->version = version;
+}
+
+MemoryCategory Storage::getCategory() const
+{
+	return category;
+}
+
+void Storage::setCategory(MemoryCategory category)
+{
+	if (values) {
+		MemoryStats::deallocate(this->category, size * sizeof(float));
+		MemoryStats::allocate(category, size * sizeof(float));
+	}
+	this->category = category;
+}
+
+const std::shared_ptr<LazyNode>& Storage::getPending() const
+{
+	return pending;
+}
+
+void Storage::setPending(const std::shared_ptr<LazyNode>& pending)
+{
+	this->pending = pending;
+}
+
+std::shared_ptr<Storage> Storage::create(int size, bool deferred)
+{
+	Arena* arena = ArenaScope::getCurrent();
+	return std::allocate_shared<Storage>(ArenaAllocator<Storage>(), size, arena, deferred);
+}
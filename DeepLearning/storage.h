@@ -0,0 +1,57 @@
+#pragma once
+#include <memory>
+
+#include "memory_stats.h"
+
+class Arena;
+struct LazyNode;
+
+// Reference-counted buffer behind a Tensor. Tensors which alias the same data hold a shared pointer to
+// one Storage, and the buffer is freed when the last of them is destroyed. Buffers allocated by size start on a
+// tensorAlignment boundary.
+class Storage {
+private:
+	float* values;
+	int size;
+	bool cached;
+	Arena* arena;
+	int version;
+	MemoryCategory category;
+	std::shared_ptr<LazyNode> pending;
+public:
+	// Allocates through the caching allocator
+	Storage(int size);
+	// Allocates from the given arena, or through the caching allocator if it is null. Deferred storages only
+	// allocate once allocate is called.
+	Storage(int size, Arena* arena, bool deferred = false);
+	// Takes ownership of a buffer allocated with new[]
+	Storage(float* values, int size);
+	~Storage();
+
+	Storage(const Storage&) = delete;
+	Storage& operator=(const Storage&) = delete;
+
+	// Null until a deferred storage has been allocated
+	float* getValues() const;
+	int getSize() const;
+	Arena* getArena() const;
+
+	// Counts in-place modifications of the values
+	int getVersion() const;
+	void incrementVersion();
+	void setVersion(int version);
+
+	// Values are counted as tensor bytes in MemoryStats until they are given another category
+	MemoryCategory getCategory() const;
+	void setCategory(MemoryCategory category);
+
+	// Operation recorded in a LazyScope which has not yet written the values, or null once they are computed
+	const std::shared_ptr<LazyNode>& getPending() const;
+	void setPending(const std::shared_ptr<LazyNode>& pending);
+
+	// Gives a deferred storage its values
+	void allocate();
+
+	// Allocates in the active ArenaScope if there is one
+	static std::shared_ptr<Storage> create(int size, bool deferred = false);
+};
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <climits>
+
+#include "thread_pool.h"
+
+namespace {
+	//Set on workers, and on the caller while it runs chunks, so that nested work runs serially
+	thread_local bool insideTask = false;
+
+	const int defaultThreshold = 1 << 15;
+}
+
+ThreadPool::ThreadPool() : numThreads(1), task(nullptr), numChunks(0), nextChunk(0), remainingChunks(0), generation(0), stopping(false),
+threshold(defaultThreshold)
+{
+	start(std::max(1, (int)std::thread::hardware_concurrency()));
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+ThreadPool& ThreadPool::getInstance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::start(int numThreads)
+{
+	stopping = false;
+	for (int i = 1; i < numThreads; i++) workers.emplace_back(&ThreadPool::work, this);
+	this->numThreads = numThreads;
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (std::thread& worker : workers) worker.join();
+	workers.clear();
+	numThreads = 1;
+}
+
+void ThreadPool::work()
+{
+	insideTask = true;
+	std::unique_lock<std::mutex> lock(mutex);
+	long long seenGeneration = generation;
+	while (true) {
+		workAvailable.wait(lock, [this, seenGeneration]() { return stopping || generation != seenGeneration; });
+		if (stopping) return;
+		seenGeneration = generation;
+		runChunks(lock);
+	}
+}
+
+void ThreadPool::runChunks(std::unique_lock<std::mutex>& lock)
+{
+	while (nextChunk < numChunks) {
+		int chunk = nextChunk++;
+		lock.unlock();
+		std::exception_ptr chunkError;
+		try {
+			(*task)(chunk);
+		}
+		catch (...) {
+			chunkError = std::current_exception();
+		}
+		lock.lock();
+		if (chunkError && !error) error = chunkError;
+		if (--remainingChunks == 0) workFinished.notify_all();
+	}
+}
+
+int ThreadPool::getNumThreads()
+{
+	return getInstance().numThreads;
+}
+
+void ThreadPool::setNumThreads(int numThreads)
+{
+	ThreadPool& pool = getInstance();
+	std::lock_guard<std::mutex> runLock(pool.runMutex);
+	pool.stop();
+	pool.start(std::max(1, numThreads));
+}
+
+int ThreadPool::getThreshold()
+{
+	return getInstance().threshold;
+}
+
+void ThreadPool::setThreshold(int threshold)
+{
+	getInstance().threshold = threshold;
+}
+
+int ThreadPool::getNumChunks(int size)
+{
+	ThreadPool& pool = getInstance();
+	if (insideTask || size < pool.threshold) return 1;
+	return std::max(1, std::min(getNumThreads(), size));
+}
+
+void ThreadPool::run(int numChunks, const std::function<void(int)>& task)
+{
+	ThreadPool& pool = getInstance();
+	std::unique_lock<std::mutex> runLock(pool.runMutex, std::defer_lock);
+	//Work started while the pool is busy with another thread's task runs on its own thread
+	if (numChunks <= 1 || insideTask || pool.numThreads == 1 || !runLock.try_lock()) {
+		for (int chunk = 0; chunk < numChunks; chunk++) task(chunk);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.task = &task;
+	pool.numChunks = numChunks;
+	pool.nextChunk = 0;
+	pool.remainingChunks = numChunks;
+	pool.error = nullptr;
+	pool.generation++;
+	pool.workAvailable.notify_all();
+
+	insideTask = true;
+	pool.runChunks(lock);
+	insideTask = false;
+	pool.workFinished.wait(lock, [&pool]() { return pool.remainingChunks == 0; });
+	pool.task = nullptr;
+	std::exception_ptr error = pool.error;
+	pool.error = nullptr;
+	lock.unlock();
+	if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::parallelFor(int size, const std::function<void(int, int)>& function, int grainSize)
+{
+	long long work = (long long)size * grainSize;
+	int numChunks = std::min(getNumChunks((int)std::min<long long>(work, INT_MAX)), size);
+	if (numChunks <= 1) {
+		if (size > 0) function(0, size);
+		return;
+	}
+	run(numChunks, [&function, size, numChunks](int chunk) {
+		int begin = (long long)size * chunk / numChunks;
+		int end = (long long)size * (chunk + 1) / numChunks;
+		function(begin, end);
+	});
+}
+
+float ThreadPool::parallelSum(int size, const std::function<float(int, int)>& function, int grainSize)
+{
+	long long work = (long long)size * grainSize;
+	int numChunks = std::min(getNumChunks((int)std::min<long long>(work, INT_MAX)), size);
+	if (numChunks <= 1) return size > 0 ? function(0, size) : 0.0f;
+
+	//Partial sums are kept per chunk and added in order, so the result does not depend on which thread ran what
+	std::vector<float> sums(numChunks);
+	run(numChunks, [&function, &sums, size, numChunks](int chunk) {
+		int begin = (long long)size * chunk / numChunks;
+		int end = (long long)size * (chunk + 1) / numChunks;
+		sums[chunk] = function(begin, end);
+	});
+	float sum = 0;
+	for (float chunkSum : sums) sum += chunkSum;
+	return sum;
+}
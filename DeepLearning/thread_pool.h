@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Process-wide pool which splits kernels into chunks. The calling thread runs chunks too, and work smaller than the
+// threshold, or started from inside another chunk, runs serially on the caller.
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	// Size of workers plus the caller, which can be read while setNumThreads replaces the workers
+	std::atomic<int> numThreads;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+	const std::function<void(int)>* task;
+	int numChunks;
+	int nextChunk;
+	int remainingChunks;
+	long long generation;
+	bool stopping;
+	std::exception_ptr error;
+	// Held while a task is running, so only one runs on the pool at a time
+	std::mutex runMutex;
+	std::atomic<int> threshold;
+
+	ThreadPool();
+	~ThreadPool();
+	static ThreadPool& getInstance();
+
+	void start(int numThreads);
+	void stop();
+	void work();
+	void runChunks(std::unique_lock<std::mutex>& lock);
+public:
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Threads which run chunks, including the caller. Defaults to the number of hardware threads.
+	static int getNumThreads();
+	static void setNumThreads(int numThreads);
+	// Number of elements below which work is not split
+	static int getThreshold();
+	static void setThreshold(int threshold);
+
+	// Number of chunks that work on this many elements is split into
+	static int getNumChunks(int size);
+	// Calls task with every chunk index below numChunks, and rethrows the first exception a chunk throws
+	static void run(int numChunks, const std::function<void(int)>& task);
+	// Splits [0, size) into ranges of roughly equal size. Each index stands for grainSize elements of work.
+	static void parallelFor(int size, const std::function<void(int, int)>& function, int grainSize = 1);
+	// Splits [0, size) like parallelFor, and adds up the values returned for each range
+	static float parallelSum(int size, const std::function<float(int, int)>& function, int grainSize = 1);
+};
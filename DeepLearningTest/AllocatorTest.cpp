@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "allocator.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace AllocatorTest
+{
+	TEST_CLASS(CachingAllocatorTest)
+	{
+	public:
+		TEST_METHOD(Reuse)
+		{
+			CachingAllocator::emptyCache();
+			float* values1 = CachingAllocator::allocate(100);
+			CachingAllocator::deallocate(values1, 100);
+			float* values2 = CachingAllocator::allocate(100);
+			ComparePointers(values1, values2);
+			CachingAllocator::deallocate(values2, 100);
+
+			//Sizes in the same size class share buffers
+			float* values3 = CachingAllocator::allocate(120);
+			ComparePointers(values1, values3);
+			CachingAllocator::deallocate(values3, 120);
+		}
+
+		TEST_METHOD(Stats)
+		{
+			CachingAllocator::emptyCache();
+			CachingAllocator::resetStats();
+			float* values1 = CachingAllocator::allocate(1000);
+			Assert::AreEqual(0LL, CachingAllocator::getHits());
+			Assert::AreEqual(1LL, CachingAllocator::getMisses());
+			CachingAllocator::deallocate(values1, 1000);
+
+			float* values2 = CachingAllocator::allocate(1000);
+			Assert::AreEqual(1LL, CachingAllocator::getHits());
+			Assert::AreEqual(1LL, CachingAllocator::getMisses());
+			CachingAllocator::deallocate(values2, 1000);
+
+			CachingAllocator::resetStats();
+			Assert::AreEqual(0LL, CachingAllocator::getHits());
+			Assert::AreEqual(0LL, CachingAllocator::getMisses());
+		}
+
+		TEST_METHOD(EmptyCache)
+		{
+			float* values1 = CachingAllocator::allocate(64);
+			CachingAllocator::deallocate(values1, 64);
+			CachingAllocator::emptyCache();
+			CachingAllocator::resetStats();
+			float* values2 = CachingAllocator::allocate(64);
+			Assert::AreEqual(1LL, CachingAllocator::getMisses());
+			CachingAllocator::deallocate(values2, 64);
+		}
+
+		TEST_METHOD(Alignment)
+		{
+			for (int size : { 1, 3, 100, 1000 }) {
+				float* values = CachingAllocator::allocate(size);
+				Assert::AreEqual((uintptr_t)0, reinterpret_cast<uintptr_t>(values) % tensorAlignment);
+				CachingAllocator::deallocate(values, size);
+			}
+		}
+
+		TEST_METHOD(TensorBuffers)
+		{
+			CachingAllocator::emptyCache();
+			Tensor tensor1a = Tensor::range({ 8, 8 });
+			{
+				Tensor tensor1b = Tensor::add(tensor1a, 1.0f);
+			}
+			CachingAllocator::resetStats();
+			Tensor tensor1c = Tensor::add(tensor1a, 2.0f);
+			Assert::AreEqual(1LL, CachingAllocator::getHits());
+			Assert::AreEqual(0LL, CachingAllocator::getMisses());
+			CompareFloats(2.0f, tensor1c.at(0));
+		}
+	};
+
+	TEST_CLASS(ArenaScopeTest)
+	{
+	public:
+		TEST_METHOD(Current)
+		{
+			Assert::IsNull(ArenaScope::getCurrent());
+			{
+				ArenaScope scope1;
+				Arena* arena1 = ArenaScope::getCurrent();
+				Assert::IsNotNull(arena1);
+				{
+					ArenaScope scope2;
+					Assert::IsTrue(ArenaScope::getCurrent() != arena1);
+				}
+				ComparePointers(arena1, ArenaScope::getCurrent());
+			}
+			Assert::IsNull(ArenaScope::getCurrent());
+		}
+
+		TEST_METHOD(Allocation)
+		{
+			auto storage1 = Storage::create(16);
+			Assert::IsNull(storage1->getArena());
+			{
+				ArenaScope scope;
+				auto storage2 = Storage::create(16);
+				ComparePointers(ArenaScope::getCurrent(), storage2->getArena());
+			}
+		}
+
+		TEST_METHOD(Alignment)
+		{
+			ArenaScope scope;
+			for (int size : { 1, 3, 100 }) {
+				auto storage = Storage::create(size);
+				Assert::AreEqual((uintptr_t)0, reinterpret_cast<uintptr_t>(storage->getValues()) % tensorAlignment);
+			}
+		}
+
+		TEST_METHOD(Reset)
+		{
+			const float* values1;
+			{
+				ArenaScope scope;
+				Tensor tensor1 = Tensor::empty({ 4, 4 });
+				values1 = tensor1.getValues();
+			}
+			{
+				ArenaScope scope;
+				Tensor tensor2 = Tensor::empty({ 4, 4 });
+				ComparePointers(values1, tensor2.getValues());
+			}
+		}
+
+		TEST_METHOD(Promote)
+		{
+			Tensor tensor1 = Tensor::zeroes({ 3 });
+			const float* values1;
+			{
+				ArenaScope scope;
+				Tensor tensor2 = Tensor::range({ 3 }, 1.0f);
+				values1 = tensor2.getValues();
+				tensor1 = Tensor::multiply(tensor2, 2.0f).promote();
+			}
+			{
+				ArenaScope scope;
+				Tensor tensor3 = Tensor::empty({ 3 });
+				ComparePointers(values1, tensor3.getValues());
+			}
+			CompareFloats(2.0f, tensor1.at(0));
+			CompareFloats(4.0f, tensor1.at(1));
+			CompareFloats(6.0f, tensor1.at(2));
+		}
+
+		TEST_METHOD(Escaped)
+		{
+			Tensor tensor1 = Tensor::zeroes({ 2 });
+			{
+				ArenaScope scope;
+				tensor1 = Tensor::full({ 2 }, 5.0f);
+			}
+			{
+				ArenaScope scope;
+				Tensor tensor2 = Tensor::zeroes({ 2 });
+			}
+			CompareFloats(5.0f, tensor1.at(0));
+			CompareFloats(5.0f, tensor1.at(1));
+		}
+	};
+}
\ No newline at end of file
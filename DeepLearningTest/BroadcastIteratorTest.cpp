@@ -0,0 +1,57 @@
+#include "pch.h"
+#include "broadcast_iterator.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace BroadcastIteratorTest
+{
+	TEST_CLASS(BroadcastIteratorTest)
+	{
+	public:
+		TEST_METHOD(Contiguous)
+		{
+			Tensor tensor = Tensor::empty({ 2, 3, 4 });
+			BroadcastIterator iterator({ 2, 3, 4 }, { &tensor });
+			for (int i = 0; i < 24; i++, iterator.next()) {
+				Assert::AreEqual(i, iterator.getOffset(0));
+			}
+		}
+
+		TEST_METHOD(Broadcast)
+		{
+			Tensor tensor1 = Tensor::empty({ 3, 1 });
+			Tensor tensor2 = Tensor::empty({ 4 });
+			BroadcastIterator iterator({ 2, 3, 4 }, { &tensor1, &tensor2 });
+			for (int i = 0; i < 24; i++, iterator.next()) {
+				Assert::AreEqual((i / 4) % 3, iterator.getOffset(0));
+				Assert::AreEqual(i % 4, iterator.getOffset(1));
+			}
+		}
+
+		TEST_METHOD(Transposed)
+		{
+			Tensor tensor = Tensor::empty({ 2, 3 }).transpose();
+			BroadcastIterator iterator({ 3, 2 }, { &tensor });
+			for (int i = 0; i < 6; i++, iterator.next()) {
+				Assert::AreEqual((i % 2) * 3 + i / 2, iterator.getOffset(0));
+			}
+		}
+
+		TEST_METHOD(Strides)
+		{
+			BroadcastIterator iterator({ 2, 2, 3 }, { { 2, 1, 3 }, { 2, 3 } }, { { 10, 0, 2 }, { 3, 1 } });
+			for (int i = 0; i < 12; i++, iterator.next()) {
+				Assert::AreEqual((i / 6) * 10 + (i % 3) * 2, iterator.getOffset(0));
+				Assert::AreEqual(i % 6, iterator.getOffset(1));
+			}
+		}
+
+		TEST_METHOD(Wraps)
+		{
+			Tensor tensor = Tensor::empty({ 2, 2 });
+			BroadcastIterator iterator({ 2, 2 }, { &tensor });
+			for (int i = 0; i < 4; i++) iterator.next();
+			Assert::AreEqual(0, iterator.getOffset(0));
+		}
+	};
+}
@@ -0,0 +1,65 @@
+#include "pch.h"
+#include <thread>
+#include "broadcast_plan.h"
+#include "util.h"
+
+namespace BroadcastPlanTest
+{
+	TEST_CLASS(BroadcastPlanTest)
+	{
+	public:
+		TEST_METHOD(Plan)
+		{
+			std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get({ 3, 1 }, { 2, 1, 4 });
+			Assert::IsTrue(std::vector<int>{ 2, 3, 4 } == plan->shape);
+			Assert::IsTrue(std::vector<int>{ 12, 4, 1 } == plan->strides);
+			Assert::AreEqual(24, plan->size);
+			Assert::IsTrue(std::vector<int>{ 0, 2 } == plan->reducedAxes[0]);
+			Assert::IsTrue(std::vector<int>{ 1 } == plan->reducedAxes[1]);
+
+			std::shared_ptr<const BroadcastPlan> scalarPlan = BroadcastPlan::get({}, { 1 });
+			Assert::IsTrue(std::vector<int>{ 1 } == scalarPlan->shape);
+			Assert::AreEqual(1, scalarPlan->size);
+			Assert::IsTrue(std::vector<int>{ 0 } == scalarPlan->reducedAxes[0]);
+			Assert::IsTrue(scalarPlan->reducedAxes[1].empty());
+
+			Assert::ExpectException<std::invalid_argument>([]() { BroadcastPlan::get({ 2, 3 }, { 4 }); });
+		}
+
+		TEST_METHOD(Cache)
+		{
+			int capacity = BroadcastPlan::getCacheCapacity();
+			BroadcastPlan::clearCache();
+			BroadcastPlan::setCacheCapacity(2);
+
+			std::shared_ptr<const BroadcastPlan> plan1 = BroadcastPlan::get({ 2 }, { 3, 1 });
+			std::shared_ptr<const BroadcastPlan> plan2 = BroadcastPlan::get({ 2, 3 }, { 1 });
+			ComparePointers(plan1.get(), BroadcastPlan::get({ 2 }, { 3, 1 }).get());
+			Assert::IsFalse(plan1.get() == plan2.get());
+
+			//The plan used longest ago is dropped first
+			BroadcastPlan::get({ 5 }, { 5 });
+			ComparePointers(plan1.get(), BroadcastPlan::get({ 2 }, { 3, 1 }).get());
+			Assert::IsFalse(plan2.get() == BroadcastPlan::get({ 2, 3 }, { 1 }).get());
+
+			BroadcastPlan::setCacheCapacity(capacity);
+		}
+
+		TEST_METHOD(Threads)
+		{
+			std::vector<std::thread> threads;
+			std::vector<int> failures(4, 0);
+			for (int i = 0; i < 4; i++) {
+				threads.emplace_back([i, &failures]() {
+					for (int j = 0; j < 1000; j++) {
+						int size = j % 300 + 1;
+						std::shared_ptr<const BroadcastPlan> plan = BroadcastPlan::get({ size, 1 }, { i + 1 });
+						if (plan->size != size * (i + 1)) failures[i]++;
+					}
+				});
+			}
+			for (std::thread& thread : threads) thread.join();
+			for (int failure : failures) Assert::AreEqual(0, failure);
+		}
+	};
+}
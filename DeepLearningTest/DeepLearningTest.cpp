@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "deep_learning.h"
+#include "memory_stats.h"
 #include "util.h"
 
 
@@ -171,6 +172,59 @@ namespace TensorTest
 			Assert::ExpectException<std::invalid_argument>([]() { Tensor::full({ 1, 0, 3 }, 10.0f); });
 		}
 
+		TEST_METHOD(Constant)
+		{
+			long long before = MemoryStats::getUsage().tensorBytes;
+			Tensor tensor1a = Tensor::full({ 4, 8 }, 3.0f);
+			Assert::IsTrue(tensor1a.isConstant());
+			Assert::AreEqual(before + 4, MemoryStats::getUsage().tensorBytes);
+
+			//Writing materializes every value, and detached copies taken before keep the constant
+			Tensor tensor1b = tensor1a.detached();
+			tensor1a.addInPlace(Tensor::range({ 8 }));
+			Assert::IsFalse(tensor1a.isConstant());
+			Assert::IsTrue(tensor1a.isContiguous());
+			Assert::AreEqual(before + 132, MemoryStats::getUsage().tensorBytes);
+			CompareFloats(3.0f, tensor1a.at({ 0, 0 }));
+			CompareFloats(10.0f, tensor1a.at({ 3, 7 }));
+			CompareFloats(3.0f, tensor1b.at({ 3, 7 }));
+
+			Tensor tensor2 = Tensor::ones({ 2, 3 });
+			tensor2.getValues()[4] = 5.0f;
+			CompareFloats(1.0f, tensor2.at(3));
+			CompareFloats(5.0f, tensor2.at(4));
+		}
+
+		TEST_METHOD(ConstantOperands)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::zeroes({ 2, 3 });
+			Tensor tensor1c = Tensor::add(tensor1a, tensor1b);
+			for (int i = 0; i < 6; i++) CompareFloats((float)i, tensor1c.at(i));
+			tensor1c.backwards(Tensor::range({ 2, 3 }, 1.0f));
+			for (int i = 0; i < 6; i++) CompareFloats(i + 1.0f, tensor1a.getGradient()->at(i));
+
+			Tensor tensor2a = Tensor::full({ 2, 3 }, 2.0f);
+			Tensor tensor2b = Tensor::full({ 3 }, 5.0f);
+			Tensor tensor2c = Tensor::multiply(tensor2a, tensor2b);
+			Assert::IsTrue(tensor2c.isConstant());
+			CompareFloats(10.0f, tensor2c.at({ 1, 2 }));
+
+			Tensor tensor3a = Tensor::range({ 2, 3 });
+			Tensor tensor3b = Tensor::full({ 2, 1 }, 2.0f);
+			Tensor tensor3c = Tensor::subtract(tensor3b, tensor3a);
+			for (int i = 0; i < 6; i++) CompareFloats(2.0f - i, tensor3c.at(i));
+
+			//Results do not share values with an operand, even when the constant leaves it unchanged
+			Tensor tensor4a = Tensor::range({ 2, 3 });
+			Tensor tensor4b = Tensor::ones({ 2, 3 });
+			Tensor tensor4c = Tensor::multiply(tensor4b, tensor4a);
+			tensor4c.fill(-1.0f);
+			for (int i = 0; i < 6; i++) CompareFloats((float)i, tensor4a.at(i));
+			tensor4a.fill(5.0f);
+			for (int i = 0; i < 6; i++) CompareFloats(-1.0f, tensor4c.at(i));
+		}
+
 		TEST_METHOD(RequiresGradient)
 		{
 			Assert::IsFalse(Tensor::full({ 4, 3, 2 }, 0.0f).requiresGradient());
@@ -487,6 +541,19 @@ namespace TensorTest
 			Assert::AreEqual(7, Tensor::zeroes({ 5, 21 }).reshape({ 3,7,5 }).getShape()[1]);
 			Assert::AreEqual(5, Tensor::zeroes({ 5, 21 }).reshape({ 3,7,5 }).getShape()[2]);
 		}
+		TEST_METHOD(TransposedValues)
+		{
+			Tensor tensor1a = Tensor::range({ 2,3 });
+			Tensor tensor1b = tensor1a.transpose();
+			tensor1b.reshape({ 6 });
+			CompareFloats(tensor1b.at(0), 0.0f);
+			CompareFloats(tensor1b.at(1), 3.0f);
+			CompareFloats(tensor1b.at(2), 1.0f);
+			CompareFloats(tensor1b.at(3), 4.0f);
+			CompareFloats(tensor1b.at(4), 2.0f);
+			CompareFloats(tensor1b.at(5), 5.0f);
+			Assert::IsTrue(tensor1b.isContiguous());
+		}
 	};
 
 	TEST_CLASS(GetTest)
@@ -792,6 +859,29 @@ namespace TensorTest
 			CompareFloats(tensor2.at({ 1,0,2 }), 3.0f);
 		}
 
+		TEST_METHOD(FastPaths)
+		{
+			Tensor tensor1 = Tensor::subtract(Tensor::range({ 2, 2 }), Tensor::full({ 2, 2 }, 1.0f));
+			CompareFloats(tensor1.at({ 0, 0 }), -1.0f);
+			CompareFloats(tensor1.at({ 1, 1 }), 2.0f);
+
+			Tensor tensor2 = Tensor::subtract(Tensor::range({ 2, 2 }), Tensor::full({ 1, 1 }, 1.0f));
+			CompareFloats(tensor2.at({ 0, 1 }), 0.0f);
+			Tensor tensor3 = Tensor::subtract(Tensor::full({ 1 }, 1.0f), Tensor::range({ 2, 2 }));
+			CompareFloats(tensor3.at({ 1, 0 }), -1.0f);
+
+			Tensor tensor4 = Tensor::subtract(Tensor::range({ 2, 3 }), Tensor::range({ 1, 3 }));
+			CompareFloats(tensor4.at({ 0, 2 }), 0.0f);
+			CompareFloats(tensor4.at({ 1, 2 }), 3.0f);
+			Tensor tensor5 = Tensor::subtract(Tensor::range({ 3 }), Tensor::range({ 2, 3 }));
+			CompareFloats(tensor5.at({ 1, 1 }), -3.0f);
+
+			Tensor tensor6a = Tensor::range({ 2, 2 }).transpose();
+			Tensor tensor6 = Tensor::subtract(tensor6a, Tensor::range({ 2, 2 }));
+			CompareFloats(tensor6.at({ 0, 1 }), 1.0f);
+			CompareFloats(tensor6.at({ 1, 0 }), -1.0f);
+		}
+
 		TEST_METHOD(Gradient)
 		{
 			Tensor tensor1a = Tensor::zeroes({ 3,1 });
@@ -1431,6 +1521,228 @@ namespace TensorTest
 		}
 	};
 
+	TEST_CLASS(BackwardsTest)
+	{
+	public:
+		TEST_METHOD(Accumulate)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::multiply(tensor1a, 2.0f);
+			tensor1b.backwards(true);
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.getGradient()->at(i), 2.0f);
+			tensor1b.backwards();
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.getGradient()->at(i), 4.0f);
+		}
+
+		TEST_METHOD(ReleaseGraph)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::multiply(tensor1a, 2.0f);
+			Tensor tensor1c = Tensor::add(tensor1b, 1.0f);
+			tensor1c.backwards(true);
+			Assert::IsNotNull(dynamic_cast<const AddSingleFunction*>(tensor1c.getFunction()));
+			Assert::IsNotNull(tensor1b.getGradient());
+
+			tensor1c.backwards();
+			Assert::IsNotNull(dynamic_cast<const ReleasedFunction*>(tensor1c.getFunction()));
+			Assert::IsNotNull(dynamic_cast<const ReleasedFunction*>(tensor1b.getFunction()));
+			Assert::IsNull(tensor1b.getGradient());
+			Assert::IsNotNull(tensor1a.getGradient());
+			Assert::ExpectException<std::logic_error>([&tensor1c]() { tensor1c.backwards(); });
+		}
+
+		TEST_METHOD(ZeroGrad)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::multiply(tensor1a, 2.0f);
+			tensor1b.backwards();
+			const float* gradientValues = tensor1a.getGradient()->getValues();
+
+			tensor1a.zeroGrad();
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.getGradient()->at(i), 0.0f);
+
+			tensor1a.zeroGrad();
+			Tensor tensor1c = Tensor::multiply(tensor1a, 3.0f);
+			tensor1c.backwards();
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.getGradient()->at(i), 3.0f);
+			ComparePointers(gradientValues, tensor1a.getGradient()->getValues());
+		}
+
+		TEST_METHOD(Constants)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::ones({ 2, 3 });
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			tensor1c.backwards();
+			Assert::IsNotNull(tensor1a.getGradient());
+			Assert::IsNull(tensor1b.getGradient());
+		}
+	};
+
+	TEST_CLASS(CheckpointTest)
+	{
+	public:
+		TEST_METHOD(Values)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			Tensor tensor1b = Tensor::checkpoint({
+				[](Tensor& x) { return Tensor::multiply(x, 2.0f); },
+				[](Tensor& x) { return Tensor::add(x, 1.0f); }
+			}, tensor1a);
+			Assert::IsFalse(tensor1b.requiresGradient());
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1b.at(i), i * 2.0f + 1.0f);
+		}
+
+		TEST_METHOD(Gradient)
+		{
+			Tensor input = Tensor::range({ 4, 3 }, -1.0f, 0.25f).requireGradient();
+			Tensor weights1 = Tensor::range({ 3, 5 }, -0.5f, 0.1f).requireGradient();
+			Tensor weights2 = Tensor::range({ 5, 2 }, 0.3f, -0.1f).requireGradient();
+
+			Tensor tensor1a = Tensor::matrixMultiply(input, weights1);
+			Tensor tensor1b = Tensor::ReLU(tensor1a);
+			Tensor tensor1c = Tensor::matrixMultiply(tensor1b, weights2);
+			Tensor tensor1d = Tensor::multiply(tensor1c, tensor1c);
+			tensor1d.backwards();
+			Tensor inputGradient = Tensor::add(*input.getGradient(), 0.0f);
+			Tensor weightGradient1 = Tensor::add(*weights1.getGradient(), 0.0f);
+			Tensor weightGradient2 = Tensor::add(*weights2.getGradient(), 0.0f);
+			input.zeroGrad();
+			weights1.zeroGrad();
+			weights2.zeroGrad();
+
+			Tensor tensor2a = Tensor::checkpoint({
+				[&weights1](Tensor& x) { return Tensor::matrixMultiply(x, weights1); },
+				[](Tensor& x) { return Tensor::ReLU(x); },
+				[&weights2](Tensor& x) { return Tensor::matrixMultiply(x, weights2); }
+			}, input);
+			Assert::IsTrue(tensor2a.requiresGradient());
+			Tensor tensor2b = Tensor::multiply(tensor2a, tensor2a);
+			tensor2b.backwards();
+			for (int i = 0; i < tensor1d.getSize(); i++) CompareFloats(tensor1d.at(i), tensor2b.at(i));
+			for (int i = 0; i < 12; i++) CompareFloats(inputGradient.at(i), input.getGradient()->at(i));
+			for (int i = 0; i < 15; i++) CompareFloats(weightGradient1.at(i), weights1.getGradient()->at(i));
+			for (int i = 0; i < 10; i++) CompareFloats(weightGradient2.at(i), weights2.getGradient()->at(i));
+		}
+
+		TEST_METHOD(Layers)
+		{
+			//The results which the outputs of layers are built from are kept after the layers return
+			Tensor input = Tensor::range({ 4, 3 }, -1.0f, 0.25f).requireGradient();
+			Tensor weights = Tensor::range({ 3, 3 }, -0.5f, 0.1f).requireGradient();
+			Tensor bias = Tensor::range({ 3 }, 0.2f, -0.1f).requireGradient();
+
+			Tensor tensor1a = Tensor::matrixMultiply(input, weights);
+			Tensor tensor1b = Tensor::add(tensor1a, bias);
+			Tensor tensor1c = Tensor::ReLU(tensor1b);
+			Tensor tensor1d = Tensor::matrixMultiply(tensor1c, weights);
+			Tensor tensor1e = Tensor::add(tensor1d, bias);
+			Tensor tensor1f = Tensor::ReLU(tensor1e);
+			tensor1f.backwards(Tensor::range({ 4, 3 }, 1.0f));
+			Tensor inputGradient = Tensor::add(*input.getGradient(), 0.0f);
+			Tensor weightGradient = Tensor::add(*weights.getGradient(), 0.0f);
+			Tensor biasGradient = Tensor::add(*bias.getGradient(), 0.0f);
+			input.zeroGrad();
+			weights.zeroGrad();
+			bias.zeroGrad();
+
+			layerFunction layer = [&weights, &bias](Tensor& x) {
+				Tensor product = Tensor::matrixMultiply(x, weights);
+				Tensor sum = Tensor::add(product, bias);
+				return Tensor::ReLU(sum);
+			};
+			layerFunction reassigningLayer = [&weights, &bias](Tensor& x) {
+				Tensor hidden = Tensor::matrixMultiply(x, weights);
+				hidden = Tensor::add(hidden, bias);
+				return Tensor::ReLU(hidden);
+			};
+			Tensor tensor2a = Tensor::checkpoint({ layer, reassigningLayer }, input);
+			tensor2a.backwards(Tensor::range({ 4, 3 }, 1.0f));
+			for (int i = 0; i < 12; i++) CompareFloats(tensor1f.at(i), tensor2a.at(i));
+			for (int i = 0; i < 12; i++) CompareFloats(inputGradient.at(i), input.getGradient()->at(i));
+			for (int i = 0; i < 9; i++) CompareFloats(weightGradient.at(i), weights.getGradient()->at(i));
+			for (int i = 0; i < 3; i++) CompareFloats(biasGradient.at(i), bias.getGradient()->at(i));
+		}
+
+		TEST_METHOD(ModifiedInput)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::multiply(tensor1a, 1.0f);
+			Tensor tensor1c = Tensor::checkpoint({ [](Tensor& x) { return Tensor::ReLU(x); } }, tensor1b);
+			tensor1b.addInPlace(1.0f);
+			Assert::ExpectException<std::runtime_error>([&tensor1c]() { tensor1c.backwards(); });
+		}
+	};
+
+	TEST_CLASS(InPlaceTest)
+	{
+	public:
+		TEST_METHOD(Scalar)
+		{
+			Tensor tensor1 = Tensor::range({ 2, 3 });
+			tensor1.addInPlace(2.0f).multiplyInPlace(3.0f).subtractInPlace(1.0f);
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1.at(i), (i + 2.0f) * 3.0f - 1.0f);
+			tensor1.fill(4.0f);
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1.at(i), 4.0f);
+		}
+
+		TEST_METHOD(Broadcast)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			Tensor tensor1b = Tensor::range({ 3 }, 1);
+			tensor1a.addInPlace(tensor1b);
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 3; j++) CompareFloats(tensor1a.at({ i, j }), i * 3 + j + j + 1.0f);
+			}
+			tensor1a.copyFrom(tensor1b);
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.at(i), i % 3 + 1.0f);
+
+			Tensor tensor2 = Tensor::range({ 3 });
+			Assert::ExpectException<std::invalid_argument>([&tensor2, &tensor1a]() { tensor2.addInPlace(tensor1a); });
+		}
+
+		TEST_METHOD(Views)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			Tensor tensor1b = tensor1a.transpose();
+			tensor1b.multiplyInPlace(tensor1a.transpose());
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.at(i), (float)(i * i));
+
+			Tensor tensor2a = Tensor::zeroes({ 3, 2 });
+			Tensor tensor2b = tensor2a.get({ 1 });
+			tensor2b.fill(1.0f);
+			CompareFloats(tensor2a.at({ 0, 0 }), 0.0f);
+			CompareFloats(tensor2a.at({ 1, 1 }), 1.0f);
+			CompareFloats(tensor2a.at({ 2, 0 }), 0.0f);
+		}
+
+		TEST_METHOD(Version)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			Tensor tensor1b = tensor1a.detached();
+			Assert::AreEqual(0, tensor1a.getVersion());
+			tensor1b.addInPlace(1.0f);
+			Assert::AreEqual(1, tensor1a.getVersion());
+		}
+
+		TEST_METHOD(ModifiedBeforeBackwards)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::range({ 2, 3 });
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			tensor1b.addInPlace(1.0f);
+			Assert::ExpectException<std::runtime_error>([&tensor1c]() { tensor1c.backwards(); });
+
+			//Gradients which do not read the modified values are unaffected
+			Tensor tensor2a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor2b = Tensor::range({ 2, 3 });
+			Tensor tensor2c = Tensor::add(tensor2a, tensor2b);
+			tensor2b.addInPlace(1.0f);
+			tensor2c.backwards();
+			for (int i = 0; i < 6; i++) CompareFloats(tensor2a.getGradient()->at(i), 1.0f);
+		}
+	};
+
 	TEST_CLASS(DetachedTest)
 	{
 	public:
@@ -1475,4 +1787,110 @@ namespace TensorTest
 			Assert::IsFalse(tensor2b.requiresGradient());
 		}
 	};
-}
+
+	TEST_CLASS(StridesTest)
+	{
+	public:
+		TEST_METHOD(Contiguous)
+		{
+			Tensor tensor1 = Tensor::empty({ 2, 3, 4 });
+			Assert::AreEqual(12, tensor1.getStrides()[0]);
+			Assert::AreEqual(4, tensor1.getStrides()[1]);
+			Assert::AreEqual(1, tensor1.getStrides()[2]);
+			Assert::IsTrue(tensor1.isContiguous());
+		}
+
+		TEST_METHOD(Transposed)
+		{
+			Tensor tensor1a = Tensor::empty({ 2, 3, 4 });
+			Tensor tensor1b = tensor1a.transpose();
+			Assert::AreEqual(12, tensor1b.getStrides()[0]);
+			Assert::AreEqual(1, tensor1b.getStrides()[1]);
+			Assert::AreEqual(4, tensor1b.getStrides()[2]);
+			Assert::IsFalse(tensor1b.isContiguous());
+		}
+
+		TEST_METHOD(Get)
+		{
+			Tensor tensor1a = Tensor::range({ 3, 2, 4 });
+			Tensor tensor1b = tensor1a.transpose().get({ 1 });
+			Assert::AreEqual(1, tensor1b.getStrides()[0]);
+			Assert::AreEqual(4, tensor1b.getStrides()[1]);
+			CompareFloats(tensor1b.at({ 3, 1 }), tensor1a.at({ 1, 1, 3 }));
+			CompareFloats(tensor1b.at(1), tensor1a.at({ 1, 1, 0 }));
+		}
+	};
+
+	TEST_CLASS(AlignmentTest)
+	{
+	public:
+		TEST_METHOD(Alignment)
+		{
+			Tensor tensor1 = Tensor::empty({ 3, 5 });
+			Assert::AreEqual(64, tensor1.getAlignment());
+			Assert::AreEqual(5, tensor1.getLeadingDimension());
+
+			//Rows after the first are only aligned to the size of a value
+			Tensor tensor2 = tensor1.get({ 1 });
+			Assert::AreEqual(4, tensor2.getAlignment());
+		}
+
+		TEST_METHOD(Padded)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3, 5 });
+			Tensor tensor1b = tensor1a.padded();
+			Assert::AreEqual(16, tensor1b.getLeadingDimension());
+			Assert::AreEqual(48, tensor1b.getStrides()[0]);
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 3; j++) {
+					Assert::AreEqual(64, tensor1b.get({ i, j }).getAlignment());
+					for (int k = 0; k < 5; k++) {
+						CompareFloats(tensor1b.at({ i, j, k }), tensor1a.at({ i, j, k }));
+					}
+				}
+			}
+
+			Tensor tensor2 = Tensor::range({ 4 });
+			Assert::ExpectException<std::length_error>([&tensor2]() { tensor2.padded(); });
+		}
+
+		TEST_METHOD(PaddedMatrixMultiply)
+		{
+			Tensor tensor1a = Tensor::range({ 3, 5 });
+			Tensor tensor1b = Tensor::range({ 2, 5, 4 }, 1);
+			Tensor tensor1c = Tensor::matrixMultiply(tensor1a, tensor1b);
+			Tensor tensor2a = tensor1a.padded();
+			Tensor tensor2b = tensor1b.padded();
+			Tensor tensor2c = Tensor::matrixMultiply(tensor2a, tensor2b);
+			for (int i = 0; i < tensor1c.getSize(); i++) {
+				CompareFloats(tensor1c.at(i), tensor2c.at(i));
+			}
+		}
+	};
+
+	TEST_CLASS(ViewOperationTest)
+	{
+	public:
+		TEST_METHOD(TransposedInput)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			Tensor tensor1b = tensor1a.transpose();
+			Tensor tensor1c = Tensor::add(tensor1b, 1.0f);
+			Assert::IsTrue(tensor1c.isContiguous());
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 2; j++) {
+					CompareFloats(tensor1c.at({ i, j }), tensor1a.at({ j, i }) + 1.0f);
+				}
+			}
+
+			Tensor tensor2a = Tensor::range({ 3, 2 }, 1);
+			Tensor tensor2b = Tensor::range({ 3, 2 }, 1);
+			Tensor tensor2c = tensor2b.transpose();
+			Tensor tensor2d = Tensor::matrixMultiply(tensor2c, tensor2a);
+			CompareFloats(tensor2d.at({ 0, 0 }), 35.0f);
+			CompareFloats(tensor2d.at({ 0, 1 }), 44.0f);
+			CompareFloats(tensor2d.at({ 1, 0 }), 44.0f);
+			CompareFloats(tensor2d.at({ 1, 1 }), 56.0f);
+		}
+	};
+}
\ No newline at end of file
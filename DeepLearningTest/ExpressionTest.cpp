@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "expression.h"
+#include "util.h"
+
+namespace ExpressionTest
+{
+	TEST_CLASS(ExpressionTest)
+	{
+	public:
+		TEST_METHOD(Values)
+		{
+			Tensor tensor1a = Tensor::range({ 3, 4 }, -2.0f, 0.5f);
+			Tensor tensor1b = Tensor::range({ 3, 4 }, 1.0f);
+			Tensor tensor1c = Tensor::range({ 3, 4 }, 3.0f, 0.25f);
+			Tensor tensor1d = (tensor1a * tensor1b - tensor1c) / 2.0f;
+			Assert::AreEqual(3, tensor1d.getShape()[0]);
+			Assert::AreEqual(4, tensor1d.getShape()[1]);
+			for (int i = 0; i < 12; i++) {
+				CompareFloats((tensor1a.at(i) * tensor1b.at(i) - tensor1c.at(i)) / 2.0f, tensor1d.at(i));
+			}
+
+			Tensor tensor2 = 1.0f - tensor1a + 3;
+			for (int i = 0; i < 12; i++) CompareFloats(4.0f - tensor1a.at(i), tensor2.at(i));
+		}
+
+		TEST_METHOD(Broadcast)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3, 4 });
+			Tensor tensor1b = Tensor::range({ 4 }, 1.0f);
+			Tensor tensor1c = Tensor::range({ 3, 1 }, 2.0f);
+			Tensor tensor1d = tensor1a.transpose();
+			Tensor tensor1e = tensor1a / tensor1b + tensor1c;
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 3; j++) {
+					for (int k = 0; k < 4; k++) {
+						CompareFloats(tensor1a.at({ i, j, k }) / (k + 1.0f) + j + 2.0f, tensor1e.at({ i, j, k }));
+					}
+				}
+			}
+
+			Tensor tensor1f = tensor1d * 2.0f;
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 4; j++) {
+					for (int k = 0; k < 3; k++) CompareFloats(tensor1a.at({ i, k, j }) * 2.0f, tensor1f.at({ i, j, k }));
+				}
+			}
+		}
+
+		TEST_METHOD(SingleFunction)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 }, 1.0f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 2, 3 }, 2.0f);
+			Tensor tensor1c = (tensor1a * tensor1b - tensor1a) / 4.0f;
+			Assert::IsTrue(tensor1c.requiresGradient());
+			std::vector<Tensor*> dependents = tensor1c.getFunction()->getDependents();
+			Assert::AreEqual(3, (int)dependents.size());
+			ComparePointers(&tensor1a, dependents[0]);
+			ComparePointers(&tensor1b, dependents[1]);
+			ComparePointers(&tensor1a, dependents[2]);
+
+			Tensor tensor2a = Tensor::range({ 2, 3 });
+			Tensor tensor2b = tensor2a + tensor2a;
+			Assert::IsFalse(tensor2b.requiresGradient());
+			Assert::IsNull(tensor2b.getFunction());
+		}
+
+		TEST_METHOD(Gradient)
+		{
+			//The gradients match those of the same chain built from separate operations
+			Tensor tensor1a = Tensor::range({ 2, 3, 4 }, -3.0f, 0.25f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 3, 1 }, 1.0f).requireGradient();
+			Tensor tensor1c = Tensor::range({ 4 }, 2.0f).requireGradient();
+			Tensor tensor1d = (tensor1a * tensor1b - tensor1c) / tensor1b;
+			tensor1d.backwards(Tensor::range({ 2, 3, 4 }, 1.0f));
+
+			Tensor tensor2a = Tensor::range({ 2, 3, 4 }, -3.0f, 0.25f).requireGradient();
+			Tensor tensor2b = Tensor::range({ 3, 1 }, 1.0f).requireGradient();
+			Tensor tensor2c = Tensor::range({ 4 }, 2.0f).requireGradient();
+			Tensor tensor2d = Tensor::multiply(tensor2a, tensor2b);
+			Tensor tensor2e = Tensor::subtract(tensor2d, tensor2c);
+			Tensor tensor2f = Tensor::divide(tensor2e, tensor2b);
+			tensor2f.backwards(Tensor::range({ 2, 3, 4 }, 1.0f));
+
+			for (int i = 0; i < 24; i++) CompareFloats(tensor2f.at(i), tensor1d.at(i));
+			for (int i = 0; i < 24; i++) CompareFloats(tensor2a.getGradient()->at(i), tensor1a.getGradient()->at(i));
+			for (int i = 0; i < 3; i++) CompareFloats(tensor2b.getGradient()->at(i), tensor1b.getGradient()->at(i));
+			for (int i = 0; i < 4; i++) CompareFloats(tensor2c.getGradient()->at(i), tensor1c.getGradient()->at(i));
+
+			Tensor tensor3a = Tensor::range({ 5 }, 1.0f).requireGradient();
+			Tensor tensor3b = 2.0f / tensor3a;
+			tensor3b.backwards(Tensor::ones({ 5 }));
+			for (int i = 0; i < 5; i++) CompareFloats(-2.0f / ((i + 1.0f) * (i + 1.0f)), tensor3a.getGradient()->at(i));
+		}
+
+		TEST_METHOD(Checkpoint)
+		{
+			//Tensors created inside a checkpointed layer are still alive when the expression's gradient is computed
+			Tensor tensor1a = Tensor::range({ 2, 3 }, -1.0f, 0.5f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 3 }, 1.0f).requireGradient();
+			layerFunction layer = [&tensor1b](Tensor& x) {
+				Tensor squared = Tensor::multiply(x, x);
+				Tensor output = squared * tensor1b - x;
+				return output;
+			};
+			Tensor tensor1c = Tensor::checkpoint({ layer }, tensor1a);
+			tensor1c.backwards(Tensor::range({ 2, 3 }, 1.0f));
+
+			Tensor tensor2a = Tensor::range({ 2, 3 }, -1.0f, 0.5f).requireGradient();
+			Tensor tensor2b = Tensor::range({ 3 }, 1.0f).requireGradient();
+			Tensor tensor2c = Tensor::multiply(tensor2a, tensor2a);
+			Tensor tensor2d = Tensor::multiply(tensor2c, tensor2b);
+			Tensor tensor2e = Tensor::subtract(tensor2d, tensor2a);
+			tensor2e.backwards(Tensor::range({ 2, 3 }, 1.0f));
+
+			for (int i = 0; i < 6; i++) CompareFloats(tensor2e.at(i), tensor1c.at(i));
+			for (int i = 0; i < 6; i++) CompareFloats(tensor2a.getGradient()->at(i), tensor1a.getGradient()->at(i));
+			for (int i = 0; i < 3; i++) CompareFloats(tensor2b.getGradient()->at(i), tensor1b.getGradient()->at(i));
+		}
+	};
+}
@@ -0,0 +1,149 @@
+#include "pch.h"
+#include <vector>
+#include "gemm.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace GemmTest
+{
+	//Compares gemm with a plain triple loop, with leading dimensions which are wider than the matrices. Accumulated
+	//products are added to the values already in out.
+	void CompareGemm(int m, int n, int k, bool transA = false, bool transB = false, bool accumulate = false)
+	{
+		int lda = (transA ? m : k) + 3, ldb = (transB ? k : n) + 5, ldOut = n + 1;
+		std::vector<float> a((transA ? k : m) * lda), b((transB ? n : k) * ldb), out(m * ldOut, -1.0f);
+		for (int i = 0; i < (int)a.size(); i++) a[i] = (i % 13) * 0.1f - 0.6f;
+		for (int i = 0; i < (int)b.size(); i++) b[i] = (i % 7) * 0.1f - 0.3f;
+		gemm(transA, transB, m, n, k, a.data(), lda, b.data(), ldb, out.data(), ldOut, accumulate);
+
+		for (int i = 0; i < m; i++) {
+			for (int j = 0; j < ldOut; j++) {
+				if (j >= n) {
+					CompareFloats(-1.0f, out[i * ldOut + j]);
+					continue;
+				}
+				float sum = accumulate ? -1.0f : 0.0f;
+				for (int p = 0; p < k; p++) {
+					sum += (transA ? a[p * lda + i] : a[i * lda + p]) * (transB ? b[j * ldb + p] : b[p * ldb + j]);
+				}
+				CompareFloats(sum, out[i * ldOut + j]);
+			}
+		}
+	}
+
+	TEST_CLASS(GemmTest)
+	{
+	public:
+		TEST_METHOD(Small)
+		{
+			CompareGemm(1, 1, 1);
+			CompareGemm(3, 5, 2);
+			CompareGemm(6, 16, 8);
+			CompareGemm(7, 17, 9);
+		}
+
+		TEST_METHOD(Blocks)
+		{
+			//Sizes which cross the blocks of every loop and leave partial tiles
+			CompareGemm(131, 37, 300);
+			CompareGemm(2, 4100, 3);
+			CompareGemm(125, 70, 513);
+		}
+
+		TEST_METHOD(Transpose)
+		{
+			for (bool transA : { false, true }) {
+				for (bool transB : { false, true }) {
+					CompareGemm(7, 17, 9, transA, transB);
+					CompareGemm(131, 37, 300, transA, transB, true);
+				}
+			}
+		}
+
+		TEST_METHOD(Levels)
+		{
+			//Every kernel has its own tile size, so the sizes leave partial tiles for all of them
+			for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512 }) {
+				if (level > getSupportedSimdLevel()) continue;
+				setSimdLevel(level);
+				CompareGemm(13, 35, 7);
+				CompareGemm(25, 67, 260);
+				CompareGemm(25, 67, 260, true, true, true);
+			}
+			setSimdLevel(getSupportedSimdLevel());
+		}
+
+		TEST_METHOD(Packed)
+		{
+			//Packed matrices give the same products as gemm, and keep the kernel they were packed for
+			int m = 37, n = 70, k = 300, ldb = 75;
+			std::vector<float> a(m * k), b(k * ldb), expected(m * n), out(m * n, 1.0f);
+			for (int i = 0; i < (int)a.size(); i++) a[i] = (i % 13) * 0.1f - 0.6f;
+			for (int i = 0; i < (int)b.size(); i++) b[i] = (i % 7) * 0.1f - 0.3f;
+			for (bool transB : { false, true }) {
+				gemm(false, transB, m, n, k, a.data(), k, b.data(), ldb, expected.data(), n);
+				for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::AVX512 }) {
+					if (level > getSupportedSimdLevel()) continue;
+					setSimdLevel(level);
+					PackedMatrix packed;
+					packed.pack(transB, k, n, b.data(), ldb);
+					setSimdLevel(getSupportedSimdLevel());
+					gemm(false, m, a.data(), k, packed, out.data(), n);
+					for (int i = 0; i < m * n; i++) CompareFloats(expected[i], out[i]);
+				}
+			}
+			setSimdLevel(getSupportedSimdLevel());
+		}
+
+		TEST_METHOD(Threads)
+		{
+			int numThreads = ThreadPool::getNumThreads(), threshold = ThreadPool::getThreshold();
+			ThreadPool::setNumThreads(4);
+			ThreadPool::setThreshold(1);
+			//Square, tall and wide products are split into different grids
+			CompareGemm(61, 75, 33);
+			CompareGemm(300, 7, 20);
+			CompareGemm(5, 500, 20);
+			CompareGemm(61, 75, 33, true, true, true);
+			//Row parts read panels of b which were packed once for them, over more than one block of depth
+			CompareGemm(40, 70, 300);
+			CompareGemm(40, 70, 300, true, true, true);
+
+			PackedMatrix packed;
+			std::vector<float> b(33 * 75, 0.5f), out(61 * 75, 0.0f);
+			packed.pack(false, 33, 75, b.data(), 75);
+			std::vector<float> a(61 * 33, 2.0f);
+			gemm(false, 61, a.data(), 33, packed, out.data(), 75);
+			for (float value : out) CompareFloats(33.0f, value);
+
+			//Batches are split across threads whole when there are enough of them
+			for (int batches : { 2, 9 }) {
+				Tensor tensor1a = Tensor::range({ batches, 13, 11 }, -1.0f, 0.01f);
+				Tensor tensor1b = Tensor::range({ 11, 17 }, 0.5f, -0.02f);
+				Tensor tensor1c = Tensor::matrixMultiply(tensor1a, tensor1b);
+				for (int i = 0; i < batches; i++) {
+					for (int x = 0; x < 13; x++) {
+						for (int y = 0; y < 17; y++) {
+							float sum = 0;
+							for (int j = 0; j < 11; j++) sum += tensor1a.at({ i, x, j }) * tensor1b.at({ j, y });
+							CompareFloats(sum, tensor1c.at({ i, x, y }));
+						}
+					}
+				}
+			}
+			ThreadPool::setNumThreads(numThreads);
+			ThreadPool::setThreshold(threshold);
+		}
+
+		TEST_METHOD(Empty)
+		{
+			std::vector<float> out(6, -1.0f);
+			gemm(false, false, 2, 3, 0, nullptr, 0, nullptr, 3, out.data(), 3, true);
+			for (float value : out) CompareFloats(-1.0f, value);
+			gemm(false, false, 2, 3, 0, nullptr, 0, nullptr, 3, out.data(), 3);
+			for (float value : out) CompareFloats(0.0f, value);
+		}
+	};
+}
@@ -405,6 +405,49 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), 6.0f);
 		}
 
+		TEST_METHOD(Reduction)
+		{
+			//Bias gradients are column sums of the previous gradient
+			Tensor tensor1a = Tensor::zeroes({ 300, 200 });
+			Tensor tensor1b = Tensor::zeroes({ 200 }).requireGradient();
+			Tensor tensor1c = Tensor::add(tensor1a, tensor1b);
+			gradientList gradients1 = tensor1c.getFunction()->calculateGradient(Tensor::range({ 300, 200 }, 0.0f, 0.00001f));
+			Tensor& gradient1 = std::get<1>(gradients1[1]);
+			for (int i = 0; i < 200; i++) {
+				float sum = 0;
+				for (int j = 0; j < 300; j++) sum += (j * 200 + i) * 0.00001f;
+				CompareFloats(sum, gradient1.at(i));
+			}
+
+			//Axes which are reduced and kept alternate, and the previous gradient is a constant
+			Tensor tensor2a = Tensor::zeroes({ 6, 1, 50, 1 }).requireGradient();
+			Tensor tensor2b = Tensor::zeroes({ 70, 1, 40 }).requireGradient();
+			Tensor tensor2c = Tensor::subtract(tensor2a, tensor2b);
+			gradientList gradients2 = tensor2c.getFunction()->calculateGradient(Tensor::full({ 6, 70, 50, 40 }, 0.5f));
+			Tensor& gradient2a = std::get<1>(gradients2[0]);
+			Tensor& gradient2b = std::get<1>(gradients2[1]);
+			for (int i = 0; i < 300; i++) CompareFloats(0.5f * 70 * 40, gradient2a.at(i));
+			for (int i = 0; i < 2800; i++) CompareFloats(-0.5f * 6 * 50, gradient2b.at(i));
+		}
+
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::add(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(1.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(1.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::add(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(1.0f, tensor2b.getGradient()->at(0));
+			CompareFloats(1.0f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::zeroes({ 1, 3 });
@@ -578,6 +621,24 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), -6.0f);
 		}
 
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::subtract(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(1.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(-1.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::subtract(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(1.0f, tensor2b.getGradient()->at(0));
+			CompareFloats(-1.0f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::zeroes({ 1, 3 });
@@ -751,6 +812,48 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), 12.0f);
 		}
 
+		TEST_METHOD(Reduction)
+		{
+			Tensor tensor1a = Tensor::range({ 40, 1, 30 }, 0.0f, 0.0001f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 50, 1 }, 1.0f, 0.02f).requireGradient();
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			gradientList gradients = tensor1c.getFunction()->calculateGradient(Tensor::range({ 40, 50, 30 }, 0.0f, 0.00001f));
+			Tensor& gradient1 = std::get<1>(gradients[0]);
+			Tensor& gradient2 = std::get<1>(gradients[1]);
+			for (int i = 0; i < 40; i++) {
+				for (int k = 0; k < 30; k++) {
+					float sum = 0;
+					for (int j = 0; j < 50; j++) sum += ((i * 50 + j) * 30 + k) * 0.00001f * (1.0f + j * 0.02f);
+					CompareFloats(sum, gradient1.at({ i, 0, k }));
+				}
+			}
+			for (int j = 0; j < 50; j++) {
+				float sum = 0;
+				for (int i = 0; i < 40; i++) {
+					for (int k = 0; k < 30; k++) sum += ((i * 50 + j) * 30 + k) * 0.00001f * (i * 30 + k) * 0.0001f;
+				}
+				CompareFloats(sum, gradient2.at(j));
+			}
+		}
+
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(3.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(2.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::multiply(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(2.0f, tensor2b.getGradient()->at(0));
+			CompareFloats(3.0f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 1, 3 });
@@ -927,6 +1030,24 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), -12.0f);
 		}
 
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::divide(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(1.0f / 3.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(-2.0f / 9.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::divide(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(0.5f, tensor2b.getGradient()->at(0));
+			CompareFloats(-0.75f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 1, 3 }, 1);
@@ -1193,6 +1314,27 @@ namespace GradientFunctionTest
 
 		}
 
+		TEST_METHOD(Transposed)
+		{
+			//Transposed inputs and gradients are read in place, and give the same gradients as copies of them
+			Tensor tensor1a = Tensor::range({ 2, 7, 3 }, -1.0f, 0.1f);
+			Tensor tensor1b = tensor1a.transpose();
+			Tensor tensor1c = Tensor::range({ 7, 5 }, 0.5f, -0.05f).requireGradient();
+			Tensor tensor1d = Tensor::range({ 2, 5, 3 }, 0.2f, 0.03f);
+			Tensor tensor1e = tensor1d.transpose();
+			Tensor tensor1f = Tensor::matrixMultiply(tensor1b, tensor1c);
+			gradientList gradients1 = tensor1f.getFunction()->calculateGradient(tensor1e);
+
+			Tensor tensor2a = Tensor::add(tensor1b, 0.0f);
+			Tensor tensor2b = Tensor::matrixMultiply(tensor2a, tensor1c);
+			Tensor tensor2c = Tensor::add(tensor1e, 0.0f);
+			gradientList gradients2 = tensor2b.getFunction()->calculateGradient(tensor2c);
+
+			for (int i = 0; i < 30; i++) CompareFloats(tensor2b.at(i), tensor1f.at(i));
+			for (int i = 0; i < 42; i++) CompareFloats(std::get<1>(gradients2[0]).at(i), std::get<1>(gradients1[0]).at(i));
+			for (int i = 0; i < 35; i++) CompareFloats(std::get<1>(gradients2[1]).at(i), std::get<1>(gradients1[1]).at(i));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 2, 3 }, 1);
@@ -1324,6 +1466,21 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(4), 0.0f);
 		}
 
+		TEST_METHOD(NonContiguous)
+		{
+			Tensor tensor1a = Tensor::range({ 2,3 }).requireGradient();
+			Tensor tensor1b = tensor1a.transpose();
+			Tensor tensor1c = Tensor::max(tensor1b, 2.5f);
+			Tensor tensor1d = Tensor::range({ 2,3 }, 1);
+			gradientList gradients1 = tensor1c.getFunction()->calculateGradient(tensor1d.transpose());
+			Tensor& gradient1 = std::get<1>(gradients1[0]);
+			CompareFloats(gradient1.at({ 0, 0 }), 0.0f);
+			CompareFloats(gradient1.at({ 0, 1 }), 4.0f);
+			CompareFloats(gradient1.at({ 1, 1 }), 5.0f);
+			CompareFloats(gradient1.at({ 2, 1 }), 6.0f);
+			CompareFloats(gradient1.at({ 2, 0 }), 0.0f);
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 2,1,3 }).requireGradient();
@@ -1437,6 +1594,24 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), 6.0f);
 		}
 
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::max(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(0.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(1.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::max(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(1.0f, tensor2b.getGradient()->at(0));
+			CompareFloats(0.0f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 1, 3 }, 1);
@@ -1615,6 +1790,24 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(5), 0.0f);
 		}
 
+		TEST_METHOD(SizeOne)
+		{
+			//Operands whose dims all have size 1 but which are missing leading dims
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::min(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(1.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(0.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::min(tensor2b, tensor2a);
+			tensor2c.backwards();
+			CompareFloats(0.0f, tensor2b.getGradient()->at(0));
+			CompareFloats(1.0f, tensor2a.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 2, 1, 3 }, 0, 2);
@@ -1731,6 +1924,23 @@ namespace GradientFunctionTest
 			CompareFloats(gradient2.at(9), 0.2f);
 		}
 
+		TEST_METHOD(SizeOne)
+		{
+			Tensor tensor1a = Tensor::full({ 1 }, 2.0f).requireGradient();
+			Tensor tensor1b = Tensor::full({ 1, 1 }, 3.0f).requireGradient();
+			Tensor tensor1c = Tensor::meanSquaredErrorLoss(tensor1a, tensor1b);
+			tensor1c.backwards();
+			CompareFloats(-2.0f, tensor1a.getGradient()->at(0));
+			CompareFloats(2.0f, tensor1b.getGradient()->at(0));
+
+			Tensor tensor2a = Tensor::full({}, 2.0f).requireGradient();
+			Tensor tensor2b = Tensor::full({ 1 }, 3.0f).requireGradient();
+			Tensor tensor2c = Tensor::meanSquaredErrorLoss(tensor2a, tensor2b);
+			tensor2c.backwards();
+			CompareFloats(-2.0f, tensor2a.getGradient()->at(0));
+			CompareFloats(2.0f, tensor2b.getGradient()->at(0));
+		}
+
 		TEST_METHOD(Dependents)
 		{
 			Tensor tensor1a = Tensor::range({ 1, 2 }, 1);
@@ -0,0 +1,123 @@
+#include "pch.h"
+#include "lazy.h"
+#include "util.h"
+
+namespace LazyTest
+{
+	TEST_CLASS(LazyTest)
+	{
+	public:
+		TEST_METHOD(Values)
+		{
+			Tensor tensor1a = Tensor::range({ 3, 2000 }, -2.0f, 0.01f);
+			Tensor tensor1b = Tensor::range({ 3, 2000 }, 1.0f, 0.5f);
+			Tensor tensor1c = Tensor::range({ 2000 }, 3.0f);
+			Tensor tensor1d = Tensor::range({ 3, 1 }, 1.0f);
+			Tensor tensor1e = Tensor::multiply(tensor1a, tensor1b);
+			Tensor tensor1f = Tensor::subtract(tensor1e, tensor1c);
+			Tensor tensor1g = Tensor::divide(tensor1f, tensor1d);
+			Tensor tensor1h = Tensor::max(tensor1g, 0.5f);
+
+			LazyScope scope;
+			Tensor tensor2e = Tensor::multiply(tensor1a, tensor1b);
+			Tensor tensor2f = Tensor::subtract(tensor2e, tensor1c);
+			Tensor tensor2g = Tensor::divide(tensor2f, tensor1d);
+			Tensor tensor2h = Tensor::max(tensor2g, 0.5f);
+			for (int i = 0; i < 6000; i++) CompareFloats(tensor1h.at(i), tensor2h.at(i));
+			//Intermediates which are still referred to are written along with the result
+			for (int i = 0; i < 6000; i++) CompareFloats(tensor1e.at(i), tensor2e.at(i));
+			for (int i = 0; i < 6000; i++) CompareFloats(tensor1g.at(i), tensor2g.at(i));
+
+			//Operands which are broadcast or transposed are gathered
+			Tensor tensor3a = Tensor::range({ 4, 3 });
+			Tensor tensor3b = tensor3a.transpose();
+			Tensor tensor3c = Tensor::range({ 4 }, 1.0f);
+			Tensor tensor3d = Tensor::add(tensor3b, tensor3c);
+			Tensor tensor3e = Tensor::multiply(tensor3d, 2.0f);
+			for (int i = 0; i < 3; i++) {
+				for (int j = 0; j < 4; j++) CompareFloats((tensor3a.at({ j, i }) + j + 1.0f) * 2.0f, tensor3e.at({ i, j }));
+			}
+		}
+
+		TEST_METHOD(Unused)
+		{
+			//Results which are never read are computed at the end of the scope, after their intermediates are freed
+			Tensor tensor1a = Tensor::range({ 100 });
+			Tensor tensor1d = Tensor::empty({ 100 });
+			{
+				LazyScope scope;
+				Tensor tensor1b = Tensor::add(tensor1a, 1.0f);
+				Tensor tensor1c = Tensor::multiply(tensor1b, tensor1b);
+				tensor1d = Tensor::subtract(tensor1c, 1.0f);
+			}
+			tensor1a.getValues()[0] = 100.0f;
+			for (int i = 0; i < 100; i++) CompareFloats((i + 1.0f) * (i + 1.0f) - 1.0f, tensor1d.at(i));
+		}
+
+		TEST_METHOD(Allocation)
+		{
+			//Buffers are allocated when the values are computed, and only for tensors which are still referred to
+			Tensor tensor1a = Tensor::range({ 100 });
+			LazyScope scope;
+			long long before = MemoryStats::getUsage().tensorBytes;
+			Tensor tensor1b = Tensor::add(tensor1a, 1.0f);
+			Tensor tensor1c = Tensor::multiply(tensor1b, tensor1b);
+			Tensor tensor1d = Tensor::subtract(tensor1c, 1.0f);
+			Assert::AreEqual(before, MemoryStats::getUsage().tensorBytes);
+			tensor1b = tensor1a;
+			tensor1c = tensor1a;
+			for (int i = 0; i < 100; i++) CompareFloats((i + 1.0f) * (i + 1.0f) - 1.0f, tensor1d.at(i));
+			Assert::AreEqual(before + 400, MemoryStats::getUsage().tensorBytes);
+
+			//Views taken before the values were allocated read them once they are
+			Tensor tensor2a = Tensor::range({ 2, 3 });
+			Tensor tensor2b = Tensor::add(tensor2a, 1.0f);
+			Tensor tensor2c = tensor2b.transpose();
+			Tensor tensor2d = tensor2b.detached();
+			CompareFloats(1.0f, tensor2b.at(0));
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 3; j++) CompareFloats(tensor2a.at({ i, j }) + 1.0f, tensor2c.at({ j, i }));
+			}
+			for (int i = 0; i < 6; i++) CompareFloats(i + 1.0f, tensor2d.at(i));
+		}
+
+		TEST_METHOD(InPlace)
+		{
+			//Operations see the values from when they were recorded
+			LazyScope scope;
+			Tensor tensor1a = Tensor::range({ 10 });
+			Tensor tensor1b = Tensor::multiply(tensor1a, 2.0f);
+			tensor1a.addInPlace(1.0f);
+			Tensor tensor1c = Tensor::add(tensor1a, tensor1b);
+			for (int i = 0; i < 10; i++) CompareFloats(i * 2.0f, tensor1b.at(i));
+			for (int i = 0; i < 10; i++) CompareFloats(i * 3.0f + 1.0f, tensor1c.at(i));
+
+			//Recorded results can be written to in place
+			Tensor tensor2a = Tensor::add(tensor1a, 1.0f);
+			tensor2a.multiplyInPlace(tensor1c);
+			for (int i = 0; i < 10; i++) CompareFloats((i + 2.0f) * (i * 3.0f + 1.0f), tensor2a.at(i));
+		}
+
+		TEST_METHOD(Gradient)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3, 4 }, -3.0f, 0.25f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 3, 1 }, 1.0f).requireGradient();
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			Tensor tensor1d = Tensor::subtract(tensor1c, 2.0f);
+			Tensor tensor1e = Tensor::ReLU(tensor1d);
+			tensor1e.backwards(Tensor::range({ 2, 3, 4 }, 1.0f));
+
+			LazyScope scope;
+			Tensor tensor2a = Tensor::range({ 2, 3, 4 }, -3.0f, 0.25f).requireGradient();
+			Tensor tensor2b = Tensor::range({ 3, 1 }, 1.0f).requireGradient();
+			Tensor tensor2c = Tensor::multiply(tensor2a, tensor2b);
+			Tensor tensor2d = Tensor::subtract(tensor2c, 2.0f);
+			Tensor tensor2e = Tensor::ReLU(tensor2d);
+			tensor2e.backwards(Tensor::range({ 2, 3, 4 }, 1.0f));
+
+			for (int i = 0; i < 24; i++) CompareFloats(tensor1e.at(i), tensor2e.at(i));
+			for (int i = 0; i < 24; i++) CompareFloats(tensor1a.getGradient()->at(i), tensor2a.getGradient()->at(i));
+			for (int i = 0; i < 3; i++) CompareFloats(tensor1b.getGradient()->at(i), tensor2b.getGradient()->at(i));
+		}
+	};
+}
@@ -0,0 +1,72 @@
+#include "pch.h"
+#include "memory_stats.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace MemoryStatsTest
+{
+	TEST_CLASS(MemoryStatsTest)
+	{
+	public:
+		TEST_METHOD(TensorBytes)
+		{
+			long long before = MemoryStats::getUsage().tensorBytes;
+			{
+				Tensor tensor1 = Tensor::empty({ 4, 8 });
+				Assert::AreEqual(before + 128, MemoryStats::getUsage().tensorBytes);
+				Tensor tensor2 = tensor1.transpose();
+				Assert::AreEqual(before + 128, MemoryStats::getUsage().tensorBytes);
+			}
+			Assert::AreEqual(before, MemoryStats::getUsage().tensorBytes);
+		}
+
+		TEST_METHOD(Peak)
+		{
+			MemoryStats::resetPeak();
+			long long before = MemoryStats::getUsage().getLiveBytes();
+			Assert::AreEqual(before, MemoryStats::getUsage().peakBytes);
+			{
+				Tensor tensor1 = Tensor::empty({ 100 });
+			}
+			Assert::AreEqual(before + 400, MemoryStats::getUsage().peakBytes);
+			MemoryStats::resetPeak();
+			Assert::AreEqual(before, MemoryStats::getUsage().peakBytes);
+		}
+	};
+
+	TEST_CLASS(MemoryScopeTest)
+	{
+	public:
+		TEST_METHOD(Categories)
+		{
+			MemoryScope scope;
+			Tensor tensor1a = Tensor::range({ 2, 3 }).requireGradient();
+			Tensor tensor1b = Tensor::range({ 2, 3 });
+			Tensor tensor1c = Tensor::multiply(tensor1a, tensor1b);
+			Assert::AreEqual(72LL, scope.getUsage().tensorBytes);
+			Assert::AreEqual(0LL, scope.getUsage().gradientBytes);
+			Assert::IsTrue(scope.getUsage().savedBytes >= 48);
+
+			tensor1c.backwards();
+			Assert::AreEqual(24LL, scope.getUsage().gradientBytes);
+			Assert::AreEqual(0LL, scope.getUsage().savedBytes);
+		}
+
+		TEST_METHOD(Nested)
+		{
+			MemoryScope scope1;
+			Tensor tensor1 = Tensor::empty({ 10 });
+			{
+				MemoryScope scope2;
+				Tensor tensor2 = Tensor::empty({ 20 });
+				Assert::AreEqual(80LL, scope2.getUsage().tensorBytes);
+				Assert::AreEqual(120LL, scope1.getUsage().tensorBytes);
+			}
+			Assert::AreEqual(40LL, scope1.getUsage().tensorBytes);
+			Assert::AreEqual(120LL, scope1.getUsage().peakBytes);
+
+			scope1.reset();
+			Assert::AreEqual(0LL, scope1.getUsage().peakBytes);
+		}
+	};
+}
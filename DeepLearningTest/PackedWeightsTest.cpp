@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "packed_weights.h"
+#include "util.h"
+
+namespace PackedWeightsTest
+{
+	TEST_CLASS(PackedWeightsTest)
+	{
+	public:
+		TEST_METHOD(Values)
+		{
+			//Batched inputs and transposed weights give the same products as unpacked weights
+			Tensor tensor1a = Tensor::range({ 3, 20, 30 }, -1.0f, 0.01f);
+			Tensor tensor1b = Tensor::range({ 30, 17 }, 0.5f, -0.02f);
+			Tensor tensor1c = Tensor::range({ 17, 30 }, 0.5f, -0.02f);
+			Tensor tensor1d = tensor1c.transpose();
+			for (Tensor* weights : { &tensor1b, &tensor1d }) {
+				PackedWeights packed(*weights);
+				Tensor tensor2a = Tensor::matrixMultiply(tensor1a, *weights);
+				Tensor tensor2b = Tensor::matrixMultiply(tensor1a, packed);
+				for (int i = 0; i < 3 * 20 * 17; i++) CompareFloats(tensor2a.at(i), tensor2b.at(i));
+			}
+
+			Tensor tensor3a = Tensor::range({ 2, 3, 4 });
+			PackedWeights packed3(tensor3a);
+			Assert::ExpectException<std::length_error>([&]() { Tensor::matrixMultiply(tensor1a, packed3); });
+		}
+
+		TEST_METHOD(Changes)
+		{
+			Tensor tensor1a = Tensor::range({ 4, 3 }, 1.0f);
+			Tensor tensor1b = Tensor::range({ 3, 2 }, 1.0f);
+			PackedWeights packed(tensor1b);
+			Tensor tensor1c = Tensor::matrixMultiply(tensor1a, packed);
+			CompareFloats(22.0f, tensor1c.at({ 0, 0 }));
+
+			//Weights modified in place are repacked
+			tensor1b.multiplyInPlace(2.0f);
+			Tensor tensor1d = Tensor::matrixMultiply(tensor1a, packed);
+			CompareFloats(44.0f, tensor1d.at({ 0, 0 }));
+
+			//As are weights which are assigned another tensor
+			tensor1b = Tensor::range({ 3, 2 }, 1.0f, 0.0f);
+			Tensor tensor1e = Tensor::matrixMultiply(tensor1a, packed);
+			CompareFloats(6.0f, tensor1e.at({ 0, 0 }));
+
+			//Writes through getValues are only seen once the packing is invalidated
+			tensor1b.getValues()[0] = 2.0f;
+			Tensor tensor1f = Tensor::matrixMultiply(tensor1a, packed);
+			CompareFloats(6.0f, tensor1f.at({ 0, 0 }));
+			packed.invalidate();
+			Tensor tensor1g = Tensor::matrixMultiply(tensor1a, packed);
+			CompareFloats(7.0f, tensor1g.at({ 0, 0 }));
+		}
+
+		TEST_METHOD(Gradient)
+		{
+			Tensor tensor1a = Tensor::range({ 5, 4 }, -1.0f, 0.2f).requireGradient();
+			Tensor tensor1b = Tensor::range({ 4, 3 }, 0.5f, -0.1f).requireGradient();
+			Tensor tensor1c = Tensor::matrixMultiply(tensor1a, tensor1b);
+			tensor1c.backwards(Tensor::range({ 5, 3 }, 1.0f));
+
+			Tensor tensor2a = Tensor::range({ 5, 4 }, -1.0f, 0.2f).requireGradient();
+			Tensor tensor2b = Tensor::range({ 4, 3 }, 0.5f, -0.1f).requireGradient();
+			PackedWeights packed(tensor2b);
+			Tensor tensor2c = Tensor::matrixMultiply(tensor2a, packed);
+			tensor2c.backwards(Tensor::range({ 5, 3 }, 1.0f));
+
+			for (int i = 0; i < 20; i++) CompareFloats(tensor1a.getGradient()->at(i), tensor2a.getGradient()->at(i));
+			for (int i = 0; i < 12; i++) CompareFloats(tensor1b.getGradient()->at(i), tensor2b.getGradient()->at(i));
+		}
+	};
+}
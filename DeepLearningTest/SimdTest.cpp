@@ -0,0 +1,62 @@
+#include "pch.h"
+#include "simd.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace SimdTest
+{
+	// Runs the ops at every supported level and compares them with the scalar loops. The sizes are not multiples of
+	// any vector width, so the tails are covered too.
+	TEST_CLASS(SimdTest)
+	{
+	private:
+		static std::vector<float> run(SimdLevel level)
+		{
+			setSimdLevel(level);
+			std::vector<float> results;
+			Tensor tensor1 = Tensor::range({ 3, 37 }, -20.0f, 0.5f).requireGradient();
+			Tensor tensor2 = Tensor::range({ 3, 37 }, 30.0f, -0.25f).requireGradient();
+			Tensor tensor3 = Tensor::range({ 37 }, 1.0f).requireGradient();
+			std::vector<Tensor> outputs;
+			outputs.reserve(9);
+			outputs.push_back(Tensor::add(tensor1, tensor2));
+			outputs.push_back(Tensor::subtract(tensor3, tensor1));
+			outputs.push_back(Tensor::multiply(tensor1, tensor3));
+			outputs.push_back(Tensor::divide(tensor1, tensor2));
+			outputs.push_back(Tensor::max(tensor1, tensor2));
+			outputs.push_back(Tensor::min(tensor1, tensor2));
+			outputs.push_back(Tensor::ReLU(tensor1));
+			outputs.push_back(Tensor::divide(tensor2, 3.0f));
+			outputs.push_back(Tensor::min(tensor2, 10.0f));
+			for (Tensor& output : outputs) {
+				for (int i = 0; i < output.getSize(); i++) results.push_back(output.at(i));
+				output.backwards(Tensor::ones(output.getShape()), true);
+			}
+			for (Tensor* tensor : { &tensor1, &tensor2, &tensor3 }) {
+				for (int i = 0; i < tensor->getSize(); i++) results.push_back(tensor->getGradient()->at(i));
+			}
+			setSimdLevel(getSupportedSimdLevel());
+			return results;
+		}
+
+	public:
+		TEST_METHOD(Levels)
+		{
+			std::vector<float> expected = run(SimdLevel::Scalar);
+			for (SimdLevel level : { SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512 }) {
+				if (level > getSupportedSimdLevel()) continue;
+				std::vector<float> results = run(level);
+				Assert::AreEqual(expected.size(), results.size());
+				for (int i = 0; i < expected.size(); i++) CompareFloats(expected[i], results[i]);
+			}
+		}
+
+		TEST_METHOD(SetLevel)
+		{
+			setSimdLevel(SimdLevel::Scalar);
+			Assert::IsTrue(getSimdLevel() == SimdLevel::Scalar);
+			setSimdLevel(SimdLevel::AVX512);
+			Assert::IsTrue(getSimdLevel() == getSupportedSimdLevel());
+		}
+	};
+}
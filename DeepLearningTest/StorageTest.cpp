@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "storage.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace StorageTest
+{
+	TEST_CLASS(StorageTest)
+	{
+	public:
+		TEST_METHOD(Size)
+		{
+			Storage storage1(1);
+			Assert::AreEqual(1, storage1.getSize());
+
+			Storage storage2(12);
+			Assert::AreEqual(12, storage2.getSize());
+
+			Storage storage3(new float[3] {1.0f, 2.0f, 3.0f}, 3);
+			Assert::AreEqual(3, storage3.getSize());
+		}
+
+		TEST_METHOD(Values)
+		{
+			Storage storage1(new float[3] {1.0f, 2.0f, 3.0f}, 3);
+			CompareFloats(1.0f, storage1.getValues()[0]);
+			CompareFloats(2.0f, storage1.getValues()[1]);
+			CompareFloats(3.0f, storage1.getValues()[2]);
+
+			Storage storage2(4);
+			for (int i = 0; i < 4; i++) storage2.getValues()[i] = i * 2.0f;
+			for (int i = 0; i < 4; i++) CompareFloats(i * 2.0f, storage2.getValues()[i]);
+		}
+
+		TEST_METHOD(SharedByCopies)
+		{
+			Tensor tensor1a = Tensor::range({ 2, 3 });
+			{
+				Tensor tensor1b = tensor1a;
+				Tensor tensor1c = tensor1b;
+				CompareFloats(tensor1a.at(4), tensor1c.at(4));
+			}
+			for (int i = 0; i < 6; i++) CompareFloats(tensor1a.at(i), (float)i);
+
+			Tensor tensor2a = Tensor::zeroes({ 4 });
+			tensor2a = Tensor::ones({ 4 });
+			for (int i = 0; i < 4; i++) CompareFloats(tensor2a.at(i), 1.0f);
+		}
+	};
+}
@@ -0,0 +1,83 @@
+#include "pch.h"
+#include "thread_pool.h"
+#include "deep_learning.h"
+#include "util.h"
+
+namespace ThreadPoolTest
+{
+	TEST_CLASS(ThreadPoolTest)
+	{
+	private:
+		// Forward and backward results of ops which cover every parallel path
+		static std::vector<float> run()
+		{
+			std::vector<float> results;
+			Tensor tensor1 = Tensor::range({ 4, 5, 6 }, -3.0f, 0.1f).requireGradient();
+			Tensor tensor2 = Tensor::range({ 5, 1 }, 1.0f).requireGradient();
+			Tensor tensor3 = Tensor::range({ 6 }, 2.0f).requireGradient();
+			Tensor tensor4 = tensor1.transpose();
+			Tensor target = Tensor::ones({ 6 });
+			std::vector<Tensor> outputs;
+			outputs.reserve(8);
+			outputs.push_back(Tensor::multiply(tensor1, tensor2));
+			outputs.push_back(Tensor::divide(tensor1, tensor3));
+			outputs.push_back(Tensor::max(tensor4, 0.5f));
+			outputs.push_back(Tensor::add(tensor1, tensor1));
+			outputs.push_back(Tensor::meanSquaredErrorLoss(tensor1, tensor2));
+			outputs.push_back(Tensor::categoricalCrossEntropyLoss(tensor1, target));
+			for (Tensor& output : outputs) {
+				for (int i = 0; i < output.getSize(); i++) results.push_back(output.at(i));
+				output.backwards(Tensor::ones(output.getShape()), true);
+			}
+			for (Tensor* tensor : { &tensor1, &tensor2, &tensor3 }) {
+				for (int i = 0; i < tensor->getSize(); i++) results.push_back(tensor->getGradient()->at(i));
+			}
+			return results;
+		}
+
+	public:
+		TEST_METHOD(MatchesSerial)
+		{
+			int numThreads = ThreadPool::getNumThreads(), threshold = ThreadPool::getThreshold();
+			ThreadPool::setNumThreads(1);
+			std::vector<float> expected = run();
+			ThreadPool::setNumThreads(4);
+			ThreadPool::setThreshold(1);
+			std::vector<float> results = run();
+			ThreadPool::setNumThreads(numThreads);
+			ThreadPool::setThreshold(threshold);
+
+			Assert::AreEqual(expected.size(), results.size());
+			for (int i = 0; i < expected.size(); i++) CompareFloats(expected[i], results[i]);
+		}
+
+		TEST_METHOD(Chunks)
+		{
+			int numThreads = ThreadPool::getNumThreads(), threshold = ThreadPool::getThreshold();
+			ThreadPool::setNumThreads(4);
+			ThreadPool::setThreshold(100);
+			Assert::AreEqual(1, ThreadPool::getNumChunks(99));
+			Assert::AreEqual(4, ThreadPool::getNumChunks(100));
+
+			std::vector<int> counts(1000, 0);
+			ThreadPool::parallelFor(1000, [&counts](int begin, int end) {
+				for (int i = begin; i < end; i++) counts[i]++;
+				//Work started from inside a chunk runs serially
+				Assert::AreEqual(1, ThreadPool::getNumChunks(1000));
+			});
+			for (int count : counts) Assert::AreEqual(1, count);
+			ThreadPool::setNumThreads(numThreads);
+			ThreadPool::setThreshold(threshold);
+		}
+
+		TEST_METHOD(Exceptions)
+		{
+			int numThreads = ThreadPool::getNumThreads();
+			ThreadPool::setNumThreads(4);
+			Assert::ExpectException<std::runtime_error>([]() {
+				ThreadPool::run(4, [](int chunk) { if (chunk == 2) throw std::runtime_error("chunk"); });
+			});
+			ThreadPool::setNumThreads(numThreads);
+		}
+	};
+}
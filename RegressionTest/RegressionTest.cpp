@@ -1,5 +1,7 @@
 #include <iostream>
 #include <deep_learning.h>
+#include <allocator.h>
+#include <packed_weights.h>
 
 int main()
 {
@@ -16,20 +18,26 @@ int main()
 
     Tensor weights1 = Tensor::uniform({ 2,5 }, 0.0, 1.0).requireGradient();
     Tensor weights2 = Tensor::uniform({ 5,1 }, 0.0, 1.0).requireGradient();
+    //Weights are repacked for the kernels only after they have been updated
+    PackedWeights packed1(weights1), packed2(weights2);
 
     for (int i = 0; i < 100; i++)
     {
-        Tensor z1 = Tensor::matrixMultiply(train_x, weights1);
+        //Every temporary from this iteration is released together when the scope ends
+        ArenaScope scope;
+        Tensor z1 = Tensor::matrixMultiply(train_x, packed1);
         Tensor a1 = Tensor::ReLU(z1);
-        Tensor z2 = Tensor::matrixMultiply(a1, weights2);
+        Tensor z2 = Tensor::matrixMultiply(a1, packed2);
 
         Tensor loss = Tensor::meanSquaredErrorLoss(z2, train_y);
         std::cout << loss.item() << std::endl;
         loss.backwards();
         for (Tensor* weight : { &weights1, &weights2 })
         {
-            Tensor offset = Tensor::multiply(*weight->getGradient(), 0.1f);
-            *weight = Tensor::subtract(*weight, offset).detached().requireGradient();
+            //Update the weights in place so they keep their gradient buffers
+            Tensor* gradient = weight->getGradient();
+            weight->subtractInPlace(gradient->multiplyInPlace(0.1f));
+            weight->zeroGrad();
         }
     }
 }
\ No newline at end of file